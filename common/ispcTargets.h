@@ -0,0 +1,96 @@
+#ifndef _ISPC_TARGETS_H_
+#define _ISPC_TARGETS_H_
+
+#include <stdio.h>
+
+/*
+  The ISPC programs are compiled for several targets at once (see
+  ISPC_TARGETS in their Makefiles).  For each target ispc emits an
+  object in which every exported function foo is named foo_<isa>, plus
+  a dispatch object whose foo calls the copy for the best target the
+  CPU supports.  So the binaries run on any x86-64 host with SSE4 and
+  use AVX-512 where there is one.
+
+  Calling foo picks the target automatically.  The declarations here
+  let a program call a given target's copy, e.g. to report the
+  throughput of each one.
+ */
+
+enum IspcIsa {
+    ISPC_ISA_SSE4,
+    ISPC_ISA_AVX2,
+    ISPC_ISA_AVX512SKX,
+    NUM_ISPC_ISAS
+};
+
+//
+// ispcTargetName --
+//
+// The ispc --target for isa, one of the values returned by the
+// programs' *_ispc_isa() functions.
+static inline const char *
+ispcTargetName(int isa) {
+    static const char *names[NUM_ISPC_ISAS] = {
+        "sse4-i32x4", "avx2-i32x8", "avx512skx-i32x16"
+    };
+    return isa >= 0 && isa < NUM_ISPC_ISAS ? names[isa] : "unknown";
+}
+
+//
+// ispcIsaSupported --
+//
+// True if this CPU can run code compiled for isa.
+static inline bool
+ispcIsaSupported(int isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+    case ISPC_ISA_SSE4:
+        return __builtin_cpu_supports("sse4.2");
+    case ISPC_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case ISPC_ISA_AVX512SKX:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd") &&
+               __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("avx512vl");
+    default:
+        return false;
+    }
+}
+
+// Declares the per-target copies of the exported function NAME, whose
+// type is TYPE, and an array NAME##_targets of them indexed by IspcIsa.
+#define ISPC_DECLARE_TARGETS(TYPE, NAME)                                      \
+    extern "C" TYPE NAME##_sse4, NAME##_avx2, NAME##_avx512skx;               \
+    static TYPE * const NAME##_targets[NUM_ISPC_ISAS] = {                     \
+        NAME##_sse4, NAME##_avx2, NAME##_avx512skx                            \
+    }
+
+// Type of the programs' *_ispc_isa() functions.
+typedef int IspcIsaFunc();
+
+//
+// ispcCheckTargets --
+//
+// Checks the per-target objects against the assumptions above: the copy
+// of a program's *_ispc_isa() linked as the isa target must say it was
+// compiled for isa.  A wrong ISA macro, or ispc naming the objects or
+// their symbols differently, shows up here rather than as mislabeled
+// timings.  Only the targets this CPU supports can be called.  Prints
+// each mismatch and returns false if there was any.
+static inline bool
+ispcCheckTargets(IspcIsaFunc * const targets[NUM_ISPC_ISAS]) {
+    bool ok = true;
+    for (int isa = 0; isa < NUM_ISPC_ISAS; ++isa) {
+        if (!ispcIsaSupported(isa))
+            continue;
+        int built = targets[isa]();
+        if (built != isa) {
+            printf("Error : the %s copy of the ISPC code was compiled for %s\n",
+                   ispcTargetName(isa), ispcTargetName(built));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+#endif
@@ -1,35 +1,537 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <math.h>
 #include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
 
 
+//
+// makePalette --
+//
+// Gray level of every iteration count from 0 to maxIterations.  Clamp
+// iteration count for this pixel, then scale the value to 0-1 range.
+// Raise resulting value to a power (<1) to increase brightness of low
+// iteration count pixels. a.k.a. Make things look cooler.
+static std::vector<unsigned char> makePalette(int maxIterations) {
+    std::vector<unsigned char> palette(std::max(maxIterations, 0) + 1);
+
+    for (size_t i = 0; i < palette.size(); ++i) {
+        float mapped = pow( std::min(static_cast<float>(maxIterations),
+                                     static_cast<float>(i)) / 256.f, .5f);
+
+        // convert back into 0-255 range, 8-bit channels
+        palette[i] = static_cast<unsigned char>(255.f * mapped);
+    }
+    return palette;
+}
+
+static inline unsigned char lookup(const std::vector<unsigned char> &palette, int value) {
+    int last = (int)palette.size() - 1;
+    return palette[std::max(0, std::min(value, last))];
+}
 
 void
 writePPMImage(int* data, int width, int height, const char *filename, int maxIterations)
 {
     FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open image file %s\n", filename);
+        return;
+    }
+
+    std::vector<unsigned char> palette = makePalette(maxIterations);
 
     // write ppm header
     fprintf(fp, "P6\n");
     fprintf(fp, "%d %d\n", width, height);
     fprintf(fp, "255\n");
 
-    for (int i = 0; i < width*height; ++i) {
+    // Convert the whole image, then write it with one call.
+    std::vector<unsigned char> pixels(3 * (size_t)width * height);
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        unsigned char result = lookup(palette, data[i]);
+        pixels[3*i] = pixels[3*i+1] = pixels[3*i+2] = result;
+    }
+    fwrite(pixels.data(), 1, pixels.size(), fp);
 
-        // Clamp iteration count for this pixel, then scale the value
-        // to 0-1 range.  Raise resulting value to a power (<1) to
-        // increase brightness of low iteration count
-        // pixels. a.k.a. Make things look cooler.
+    fclose(fp);
+    printf("Wrote image file %s\n", filename);
+}
 
-        float mapped = pow( std::min(static_cast<float>(maxIterations),
-                                     static_cast<float>(data[i])) / 256.f, .5f);
 
-        // convert back into 0-255 range, 8-bit channels
-        unsigned char result = static_cast<unsigned char>(255.f * mapped);
-        for (int j = 0; j < 3; ++j)
-            fputc(result, fp);
+//
+// writeFloatPPMImage --
+//
+// writePPMImage() for fractional iteration counts, such as the average
+// of several samples per pixel.
+void
+writeFloatPPMImage(float* data, int width, int height, const char *filename, int maxIterations)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open image file %s\n", filename);
+        return;
+    }
+
+    fprintf(fp, "P6\n");
+    fprintf(fp, "%d %d\n", width, height);
+    fprintf(fp, "255\n");
+
+    std::vector<unsigned char> pixels(3 * (size_t)width * height);
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        float count = std::max(0.f, std::min(static_cast<float>(maxIterations), data[i]));
+        // pow(x, .5), as in makePalette()
+        unsigned char result = static_cast<unsigned char>(255.f * sqrtf(count / 256.f));
+        pixels[3*i] = pixels[3*i+1] = pixels[3*i+2] = result;
+    }
+    fwrite(pixels.data(), 1, pixels.size(), fp);
+
+    fclose(fp);
+    printf("Wrote image file %s\n", filename);
+}
+
+//
+// writeSmoothPPMImage --
+//
+// Colors an image of smooth escape values in [0, 1] (see
+// mandelbrotSmooth()) through a cyclic palette.  Points inside the set
+// (value 1) are black.
+void
+writeSmoothPPMImage(float* data, int width, int height, const char *filename)
+{
+    // Entries in the palette, and how many times it repeats from 0 to 1
+    // (after the square root that stretches the low values)
+    const int PALETTE_SIZE = 1024;
+    const float PALETTE_CYCLES = 3.f;
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open image file %s\n", filename);
+        return;
+    }
+
+    // cosine gradient from dark blue through white to orange
+    unsigned char palette[PALETTE_SIZE][3];
+    for (int i = 0; i < PALETTE_SIZE; i++) {
+        const float phase[3] = { .0f, .1f, .2f };
+        float t = (float)i / PALETTE_SIZE;
+        for (int c = 0; c < 3; c++) {
+            float value = .5f + .5f * cosf(6.2831853f * (t + phase[c]) + 3.1415927f);
+            palette[i][c] = static_cast<unsigned char>(255.f * value);
+        }
+    }
+
+    fprintf(fp, "P6\n");
+    fprintf(fp, "%d %d\n", width, height);
+    fprintf(fp, "255\n");
+
+    std::vector<unsigned char> pixels(3 * (size_t)width * height);
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        unsigned char *rgb = &pixels[3*i];
+        float value = data[i];
+        if (!(value < 1.f)) {
+            rgb[0] = rgb[1] = rgb[2] = 0;
+            continue;
+        }
+
+        float position = sqrtf(std::max(value, 0.f)) * PALETTE_CYCLES;
+        int index = (int)((position - (int)position) * PALETTE_SIZE);
+        index = std::min(index, PALETTE_SIZE - 1);
+        rgb[0] = palette[index][0];
+        rgb[1] = palette[index][1];
+        rgb[2] = palette[index][2];
+    }
+    fwrite(pixels.data(), 1, pixels.size(), fp);
+
+    fclose(fp);
+    printf("Wrote image file %s\n", filename);
+}
+
+/*
+  Streaming PGM output, for images too large to keep in memory.  Rows
+  are converted and appended as they are rendered.  8-bit images use the
+  same gray levels as writePPMImage(); 16-bit images store the iteration
+  count itself (clamped to 65535), big-endian as PGM requires.
+ */
+
+struct PGMStream {
+    FILE *fp;
+    std::string filename;
+    int width;
+    int bitDepth;
+    int maxValue;
+    std::vector<unsigned char> palette;
+    std::vector<unsigned char> row;
+};
+
+PGMStream *
+openPGMStream(const char *filename, int width, int height, int maxIterations, int bitDepth)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open image file %s\n", filename);
+        return NULL;
+    }
+
+    PGMStream *stream = new PGMStream;
+    stream->fp = fp;
+    stream->filename = filename;
+    stream->width = width;
+    stream->bitDepth = bitDepth == 16 ? 16 : 8;
+    if (stream->bitDepth == 8) {
+        stream->palette = makePalette(maxIterations);
+        stream->maxValue = 255;
+    } else {
+        stream->maxValue = std::max(1, std::min(maxIterations, 65535));
+    }
+    stream->row.resize((size_t)width * (stream->bitDepth / 8));
+
+    fprintf(fp, "P5\n%d %d\n%d\n", width, height, stream->maxValue);
+    return stream;
+}
+
+void
+writePGMRows(PGMStream *stream, const int *data, int numRows)
+{
+    int width = stream->width;
+    unsigned char *row = stream->row.data();
+
+    for (int j = 0; j < numRows; j++) {
+        const int *values = data + (size_t)j * width;
+        if (stream->bitDepth == 8) {
+            for (int i = 0; i < width; i++)
+                row[i] = lookup(stream->palette, values[i]);
+        } else {
+            for (int i = 0; i < width; i++) {
+                int value = std::max(0, std::min(values[i], stream->maxValue));
+                row[2*i] = value >> 8;
+                row[2*i+1] = value & 0xff;
+            }
+        }
+        fwrite(row, 1, stream->row.size(), stream->fp);
+    }
+}
+
+// Returns false if any write failed (e.g. the disk filled up).
+bool
+closePGMStream(PGMStream *stream)
+{
+    bool ok = !ferror(stream->fp);
+    ok = fclose(stream->fp) == 0 && ok;
+    if (ok)
+        printf("Wrote image file %s\n", stream->filename.c_str());
+    else
+        fprintf(stderr, "Error writing image file %s\n", stream->filename.c_str());
+    delete stream;
+    return ok;
+}
+
+/*
+  PNG output, without depending on zlib.
+
+  The image is written as 8-bit grayscale (the PPM has three equal
+  channels anyway).  Every row uses the "up" filter, so flat areas turn
+  into runs of zeros, and the deflate stream only encodes runs: a literal
+  followed by distance 1 matches, with the fixed Huffman code.  That
+  compresses these images well and is cheap enough to keep up with the
+  renderers.
+
+  Rows are split into bands that are filtered and compressed on separate
+  threads.  Each band ends with an empty stored block so it is byte
+  aligned and the bands can simply be concatenated, and the Adler-32
+  checksums of the bands are combined at the end.
+ */
+
+struct BitWriter {
+    std::vector<unsigned char> bytes;
+    uint32_t bitBuffer;
+    int bitCount;
+
+    BitWriter() : bitBuffer(0), bitCount(0) {}
+
+    // Appends the low count bits of bits, least significant first.
+    void put(uint32_t bits, int count) {
+        bitBuffer |= bits << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            bytes.push_back(bitBuffer & 0xff);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
     }
+
+    // Huffman codes are defined most significant bit first.
+    void putCode(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++)
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+
+    void alignToByte() {
+        if (bitCount > 0)
+            put(0, 8 - bitCount);
+    }
+};
+
+static void putLiteral(BitWriter &out, int symbol) {
+    if (symbol < 144)
+        out.putCode(0x30 + symbol, 8);
+    else if (symbol < 256)
+        out.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        out.putCode(symbol - 256, 7);
+    else
+        out.putCode(0xc0 + symbol - 280, 8);
+}
+
+// Emits a match of length 3-258 at distance 1.
+static void putRun(BitWriter &out, int length) {
+    static const int base[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int extra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+    int code = 28;
+    while (base[code] > length)
+        code--;
+    putLiteral(out, 257 + code);
+    if (extra[code])
+        out.put(length - base[code], extra[code]);
+
+    // distance code 0 (distance 1), 5 bits, no extra bits
+    out.putCode(0, 5);
+}
+
+static uint32_t adler32(const unsigned char *data, size_t length) {
+    const uint32_t BASE = 65521;
+    uint32_t a = 1, b = 0;
+
+    while (length > 0) {
+        // largest block that cannot overflow b before the modulo
+        size_t block = std::min(length, (size_t)5552);
+        for (size_t i = 0; i < block; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= BASE;
+        b %= BASE;
+        data += block;
+        length -= block;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of the concatenation of two buffers, given the checksum of
+// each and the length of the second.
+static uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2) {
+    const uint32_t BASE = 65521;
+    uint32_t rem = length2 % BASE;
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % BASE);
+
+    sum1 += (adler2 & 0xffff) + BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + BASE - rem;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum2 >= 2 * BASE) sum2 -= 2 * BASE;
+    if (sum2 >= BASE) sum2 -= BASE;
+    return (sum2 << 16) | sum1;
+}
+
+static std::vector<uint32_t> makeCrcTable() {
+    std::vector<uint32_t> table(256);
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+    return table;
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t length) {
+    static const std::vector<uint32_t> table = makeCrcTable();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+//
+// compressBand --
+//
+// Filters rows [startRow, endRow) of the gray image and appends them to
+// out as a non-final deflate block, followed by an empty stored block
+// that byte aligns the output.  Returns the Adler-32 of the filtered
+// bytes.
+static uint32_t compressBand(const unsigned char *gray, int width,
+                             int startRow, int endRow, BitWriter &out) {
+    std::vector<unsigned char> filtered;
+    filtered.reserve((size_t)(endRow - startRow) * (width + 1));
+
+    for (int j = startRow; j < endRow; j++) {
+        const unsigned char *row = gray + (size_t)j * width;
+        const unsigned char *above = j > 0 ? row - width : NULL;
+
+        filtered.push_back(above ? 2 : 0);  // filter type: up, or none
+        for (int i = 0; i < width; i++)
+            filtered.push_back(above ? (unsigned char)(row[i] - above[i]) : row[i]);
+    }
+
+    // BFINAL = 0, BTYPE = 01 (fixed Huffman)
+    out.put(0, 1);
+    out.put(1, 2);
+
+    size_t n = filtered.size();
+    size_t i = 0;
+    while (i < n) {
+        unsigned char value = filtered[i];
+        putLiteral(out, value);
+
+        size_t runEnd = i + 1;
+        while (runEnd < n && filtered[runEnd] == value)
+            runEnd++;
+
+        size_t repeat = runEnd - i - 1;
+        while (repeat >= 3) {
+            int length = (int)std::min(repeat, (size_t)258);
+            // don't leave a remainder of 1 or 2 that has to be literals
+            // when a shorter match would absorb it
+            if (repeat - length > 0 && repeat - length < 3)
+                length -= 3;
+            putRun(out, length);
+            repeat -= length;
+        }
+        while (repeat-- > 0)
+            putLiteral(out, value);
+
+        i = runEnd;
+    }
+    putLiteral(out, 256);  // end of block
+
+    // empty stored block: BFINAL = 0, BTYPE = 00, LEN = 0, NLEN = ~0
+    out.put(0, 3);
+    out.alignToByte();
+    out.put(0x0000, 16);
+    out.put(0xffff, 16);
+
+    return adler32(filtered.data(), filtered.size());
+}
+
+static void putChunk(FILE *fp, const char *type, const unsigned char *data, size_t length) {
+    unsigned char header[8] = {
+        (unsigned char)(length >> 24), (unsigned char)(length >> 16),
+        (unsigned char)(length >> 8), (unsigned char)length,
+        (unsigned char)type[0], (unsigned char)type[1],
+        (unsigned char)type[2], (unsigned char)type[3] };
+
+    uint32_t crc = crc32(0, header + 4, 4);
+    crc = crc32(crc, data, length);
+    unsigned char trailer[4] = {
+        (unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+        (unsigned char)(crc >> 8), (unsigned char)crc };
+
+    fwrite(header, 1, 8, fp);
+    if (length > 0)
+        fwrite(data, 1, length, fp);
+    fwrite(trailer, 1, 4, fp);
+}
+
+//
+// writePNGImage --
+//
+// Same image as writePPMImage(), as a compressed grayscale PNG.  The
+// conversion and compression are split across numThreads threads.
+void
+writePNGImage(int* data, int width, int height, const char *filename, int maxIterations,
+              int numThreads)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open image file %s\n", filename);
+        return;
+    }
+
+    std::vector<unsigned char> palette = makePalette(maxIterations);
+    numThreads = std::max(1, std::min(numThreads, height));
+
+    int rowsPerBand = (height + numThreads - 1) / numThreads;
+    int numBands = (height + rowsPerBand - 1) / rowsPerBand;
+
+    std::vector<unsigned char> gray((size_t)width * height);
+    std::vector<BitWriter> bands(numBands);
+    std::vector<uint32_t> bandAdler(numBands);
+
+    // The up filter of a band's first row reads the row above it, so
+    // every band is converted before any is compressed.
+    auto convert = [&](int band) {
+        size_t begin = (size_t)band * rowsPerBand * width;
+        size_t end = std::min((size_t)(band + 1) * rowsPerBand, (size_t)height) * width;
+        for (size_t i = begin; i < end; i++)
+            gray[i] = lookup(palette, data[i]);
+    };
+    auto compress = [&](int band) {
+        int startRow = band * rowsPerBand;
+        int endRow = std::min(startRow + rowsPerBand, height);
+        bandAdler[band] = compressBand(gray.data(), width, startRow, endRow, bands[band]);
+    };
+
+    std::vector<std::thread> threads;
+    for (int b = 1; b < numBands; b++)
+        threads.push_back(std::thread(convert, b));
+    convert(0);
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    threads.clear();
+    for (int b = 1; b < numBands; b++)
+        threads.push_back(std::thread(compress, b));
+    compress(0);
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    // zlib stream: header, the bands, a final empty block, Adler-32
+    std::vector<unsigned char> idat;
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    uint32_t adler = 1;
+    for (int b = 0; b < numBands; b++) {
+        idat.insert(idat.end(), bands[b].bytes.begin(), bands[b].bytes.end());
+        int startRow = b * rowsPerBand;
+        int endRow = std::min(startRow + rowsPerBand, height);
+        adler = adler32Combine(adler, bandAdler[b], (size_t)(endRow - startRow) * (width + 1));
+    }
+    // BFINAL = 1, BTYPE = 01, end of block
+    BitWriter last;
+    last.put(1, 1);
+    last.put(1, 2);
+    putLiteral(last, 256);
+    last.alignToByte();
+    idat.insert(idat.end(), last.bytes.begin(), last.bytes.end());
+    for (int shift = 24; shift >= 0; shift -= 8)
+        idat.push_back((adler >> shift) & 0xff);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, 8, fp);
+
+    // 8-bit grayscale, deflate, adaptive filtering, no interlace
+    unsigned char ihdr[13] = {
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16),
+        (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16),
+        (unsigned char)(height >> 8), (unsigned char)height,
+        8, 0, 0, 0, 0 };
+    putChunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    putChunk(fp, "IDAT", idat.data(), idat.size());
+    putChunk(fp, "IEND", NULL, 0);
+
     fclose(fp);
     printf("Wrote image file %s\n", filename);
 }
@@ -72,7 +72,6 @@
 #endif // ISPC_USE_GCD
 #ifdef ISPC_USE_PTHREADS
   #include <pthread.h>
-  #include <semaphore.h>
   #include <unistd.h>
   #include <fcntl.h>
   #include <errno.h>
@@ -81,9 +80,15 @@
   #include <sys/param.h>
   #include <vector>
   #include <algorithm>
+  #include "CycleTimer.h"
 #endif // ISPC_USE_PTHREADS
 #ifdef ISPC_IS_LINUX
   #include <malloc.h>
+  #include <limits.h>
+  #include <time.h>
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <sched.h>
 #endif // ISPC_IS_LINUX
 #include <stdio.h>
 #include <stdint.h>
@@ -91,31 +96,209 @@
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <vector>
 
 // Signature of ispc-generated 'task' functions
 typedef void (*TaskFuncType)(void *data, int threadIndex, int threadCount,
                              int taskIndex, int taskCount);
 
-// Small structure used to hold the data for each task
-struct TaskInfo {
+#if defined(ISPC_USE_PTHREADS)
+#define MAX_NUMA_NODES 8
+
+// A contiguous block of a launch's task indices, [next, end), padded to
+// keep the counters of different blocks on different cache lines.
+struct TaskBlock {
+    std::atomic<int64_t> next;
+    int64_t end;
+    char pad[48];
+};
+#endif // ISPC_USE_PTHREADS
+
+// One launch of taskCount tasks.  The tasks differ only in their task
+// index, so a single record describes all of them; the threads running
+// them hand out indices from an atomic counter (one per NUMA node's
+// block of indices with pthreads).
+struct LaunchInfo {
     TaskFuncType func;
     void *data;
-    int taskIndex, taskCount;
+    int taskCount;
 #if defined(ISPC_IS_WINDOWS)
-    event taskEvent;
+    std::atomic<int64_t> nextTaskIndex;
+    std::atomic<int> numRunning;
+    event launchEvent;
+#endif
+#if defined(ISPC_USE_PTHREADS)
+    int numBlocks;
+    TaskBlock blocks[MAX_NUMA_NODES];
+    class TaskGroup *taskGroup;
+    int traceId;
 #endif
 };
 
 ///////////////////////////////////////////////////////////////////////////
-// TaskGroupBase
+// AllocArena
+
+#define ARENA_MIN_BLOCK_SIZE ((int64_t)64 * 1024)
+#define ARENA_NUM_SIZE_CLASSES 32
+
+/* ISPCAlloc() memory comes from an arena per thread.  A task group only
+   allocates on the thread running the ispc function that owns it, and
+   that function syncs the group before it returns, so on each thread
+   groups allocate and sync in stack order.  A group's Sync() can thus
+   free everything it allocated at once, by resetting its thread's arena
+   to where it was at the group's first allocation.
+
+   The arena is a stack of blocks, each ARENA_MIN_BLOCK_SIZE << k bytes
+   for some size class k, that allocations are bumped out of.  Blocks
+   emptied by a reset go on a free list for their class rather than back
+   to the heap, so once warmed up ISPCAlloc() does not call malloc().
+ */
+class AllocArena {
+    struct Block;
+
+public:
+    // A position in the arena to reset to.
+    struct Mark {
+        Block *block;
+        int64_t used, bytesInUse;
+    };
+
+    AllocArena();
+    ~AllocArena();
 
-#define LOG_TASK_QUEUE_CHUNK_SIZE 14
-#define MAX_TASK_QUEUE_CHUNKS 8
-#define TASK_QUEUE_CHUNK_SIZE (1<<LOG_TASK_QUEUE_CHUNK_SIZE)
+    void *Alloc(int64_t size, int32_t alignment);
+    Mark GetMark() const;
+    void Reset(const Mark &mark);
 
-#define MAX_LAUNCHED_TASKS (MAX_TASK_QUEUE_CHUNKS * TASK_QUEUE_CHUNK_SIZE)
+    // Bytes allocated (including alignment padding) and not yet reset.
+    int64_t BytesInUse() const { return bytesInUse; }
+
+private:
+    struct Block {
+        Block *prev;
+        int sizeClass;
+        int64_t size, used;
+        char *Data() { return (char *)(this + 1); }
+    };
+
+    Block *current;
+    Block *freeBlocks[ARENA_NUM_SIZE_CLASSES];
+    int64_t bytesInUse, peakBytesInUse;
+};
+
+// ISPCAlloc() statistics, reported at exit with pthreads if
+// ISPC_TASKSYS_STATS is set.
+static std::atomic<int64_t> numAllocGroups(0), totalGroupBytes(0), peakGroupBytes(0);
+static std::atomic<int64_t> peakArenaBytes(0), numArenaBlocks(0);
+
+static thread_local AllocArena tlsArena;
+
+
+static inline void
+lAtomicMax(std::atomic<int64_t> *value, int64_t v) {
+    int64_t cur = value->load(std::memory_order_relaxed);
+    while (v > cur && !value->compare_exchange_weak(cur, v, std::memory_order_relaxed))
+        ;
+}
+
+
+inline AllocArena::AllocArena() {
+    current = NULL;
+    for (int i = 0; i < ARENA_NUM_SIZE_CLASSES; ++i)
+        freeBlocks[i] = NULL;
+    bytesInUse = 0;
+    peakBytesInUse = 0;
+}
+
+
+inline AllocArena::~AllocArena() {
+    Reset(Mark());
+    for (int i = 0; i < ARENA_NUM_SIZE_CLASSES; ++i)
+        while (freeBlocks[i] != NULL) {
+            Block *b = freeBlocks[i];
+            freeBlocks[i] = b->prev;
+            free(b);
+        }
+}
+
+
+inline void *
+AllocArena::Alloc(int64_t size, int32_t alignment) {
+    if (current != NULL) {
+        int64_t base = (int64_t)current->Data();
+        int64_t iptr = (base + current->used + (alignment-1)) & ~(int64_t)(alignment-1);
+        int64_t newUsed = iptr + size - base;
+        if (newUsed <= current->size) {
+            bytesInUse += newUsed - current->used;
+            current->used = newUsed;
+            if (bytesInUse > peakBytesInUse) {
+                peakBytesInUse = bytesInUse;
+                lAtomicMax(&peakArenaBytes, peakBytesInUse);
+            }
+            return (char *)iptr;
+        }
+    }
+
+    // Start a new block, big enough for this allocation however it is
+    // aligned.
+    int sizeClass = 0;
+    while ((ARENA_MIN_BLOCK_SIZE << sizeClass) < size + alignment)
+        ++sizeClass;
+    assert(sizeClass < ARENA_NUM_SIZE_CLASSES);
+
+    Block *b = freeBlocks[sizeClass];
+    if (b != NULL)
+        freeBlocks[sizeClass] = b->prev;
+    else {
+        int64_t blockSize = ARENA_MIN_BLOCK_SIZE << sizeClass;
+        b = (Block *)malloc(sizeof(Block) + blockSize);
+        if (b == NULL) {
+            fprintf(stderr, "Out of memory allocating %lld bytes for ISPCAlloc()\n",
+                    (long long)blockSize);
+            exit(1);
+        }
+        b->sizeClass = sizeClass;
+        b->size = blockSize;
+        ++numArenaBlocks;
+    }
+    b->used = 0;
+    b->prev = current;
+    current = b;
+    return Alloc(size, alignment);
+}
 
-#define NUM_MEM_BUFFERS 16
+
+inline AllocArena::Mark
+AllocArena::GetMark() const {
+    Mark mark;
+    mark.block = current;
+    mark.used = current != NULL ? current->used : 0;
+    mark.bytesInUse = bytesInUse;
+    return mark;
+}
+
+
+inline void
+AllocArena::Reset(const Mark &mark) {
+    while (current != mark.block) {
+        assert(current != NULL);
+        Block *b = current;
+        current = b->prev;
+        b->prev = freeBlocks[b->sizeClass];
+        freeBlocks[b->sizeClass] = b;
+    }
+    if (current != NULL)
+        current->used = mark.used;
+    bytesInUse = mark.bytesInUse;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// TaskGroupBase
+
+#define LOG_LAUNCH_CHUNK_SIZE 6
+#define LAUNCH_CHUNK_SIZE (1<<LOG_LAUNCH_CHUNK_SIZE)
 
 class TaskGroup;
 
@@ -128,8 +311,8 @@ class TaskGroupBase {
 public:
     void Reset();
 
-    int AllocTaskInfo(int count);
-    TaskInfo *GetTaskInfo(int index);
+    int AllocLaunchInfo();
+    LaunchInfo *GetLaunchInfo(int index);
 
     void *AllocMemory(int64_t size, int32_t alignment);
 
@@ -137,111 +320,77 @@ protected:
     TaskGroupBase();
     ~TaskGroupBase();
 
-    int nextTaskInfoIndex;
+    int nextLaunchIndex;
 
 private:
-    /* We allocate blocks of TASK_QUEUE_CHUNK_SIZE TaskInfo structures as
-       needed by the calling function.  We hold up to MAX_TASK_QUEUE_CHUNKS
-       of these (and then exit at runtime if more than this many tasks are
-       launched.)
+    /* We allocate blocks of LAUNCH_CHUNK_SIZE LaunchInfo structures as
+       needed by the calling function, one per launch, so there is no
+       limit on the number of launches or tasks.  Blocks are never moved,
+       since other threads hold pointers to the records in them.
      */
-    TaskInfo *taskInfo[MAX_TASK_QUEUE_CHUNKS];
+    std::vector<LaunchInfo *> launchInfo;
 
-    /* We also allocate chunks of memory to service ISPCAlloc() calls.  The
-       memBuffers[] array holds pointers to this memory.  The first element
-       of this array is initialized to point to mem and then any subsequent
-       elements required are initialized with dynamic allocation.
+    /* ISPCAlloc() calls are served from the allocating thread's arena
+       (NULL until the first one), which Reset() winds back to arenaMark.
      */
-    int curMemBuffer, curMemBufferOffset;
-    int memBufferSize[NUM_MEM_BUFFERS];
-    char *memBuffers[NUM_MEM_BUFFERS];
-    char mem[256];
+    AllocArena *arena;
+    AllocArena::Mark arenaMark;
 };
 
 
 inline TaskGroupBase::TaskGroupBase() { 
-    nextTaskInfoIndex = 0; 
-
-    curMemBuffer = 0; 
-    curMemBufferOffset = 0;
-    memBuffers[0] = mem;
-    memBufferSize[0] = sizeof(mem) / sizeof(mem[0]);
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i) {
-        memBuffers[i] = NULL;
-        memBufferSize[i] = 0;
-    }
-
-    for (int i = 0; i < MAX_TASK_QUEUE_CHUNKS; ++i)
-        taskInfo[i] = NULL;
+    nextLaunchIndex = 0; 
+    arena = NULL;
 }
 
 
 inline TaskGroupBase::~TaskGroupBase() {
-    // Note: don't delete memBuffers[0], since it points to the start of
-    // the "mem" member!
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i)
-        delete[] memBuffers[i];
+    for (size_t i = 0; i < launchInfo.size(); ++i)
+        delete[] launchInfo[i];
 }
 
 
 inline void
 TaskGroupBase::Reset() {
-    nextTaskInfoIndex = 0; 
-    curMemBuffer = 0; 
-    curMemBufferOffset = 0;
+    nextLaunchIndex = 0; 
+
+    if (arena != NULL) {
+        // We're on the thread that allocated (see AllocArena).
+        assert(arena == &tlsArena);
+        int64_t bytes = arena->BytesInUse() - arenaMark.bytesInUse;
+        ++numAllocGroups;
+        totalGroupBytes += bytes;
+        lAtomicMax(&peakGroupBytes, bytes);
+        arena->Reset(arenaMark);
+        arena = NULL;
+    }
 }
 
 
 inline int
-TaskGroupBase::AllocTaskInfo(int count) {
-    int ret = nextTaskInfoIndex;
-    nextTaskInfoIndex += count;
-    return ret;
+TaskGroupBase::AllocLaunchInfo() {
+    return nextLaunchIndex++;
 }
 
 
-inline TaskInfo *
-TaskGroupBase::GetTaskInfo(int index) {
-    int chunk = (index >> LOG_TASK_QUEUE_CHUNK_SIZE);
-    int offset = index & (TASK_QUEUE_CHUNK_SIZE-1);
-
-    if (chunk == MAX_TASK_QUEUE_CHUNKS) {
-        fprintf(stderr, "A total of %d tasks have been launched from the "
-                "current function--the simple built-in task system can handle "
-                "no more. You can increase the values of TASK_QUEUE_CHUNK_SIZE "
-                "and LOG_TASK_QUEUE_CHUNK_SIZE to work around this limitation.  "
-                "Sorry!  Exiting.\n", index);
-        exit(1);
-    }
+inline LaunchInfo *
+TaskGroupBase::GetLaunchInfo(int index) {
+    size_t chunk = (index >> LOG_LAUNCH_CHUNK_SIZE);
+    int offset = index & (LAUNCH_CHUNK_SIZE-1);
 
-    if (taskInfo[chunk] == NULL)
-        taskInfo[chunk] = new TaskInfo[TASK_QUEUE_CHUNK_SIZE];
-    return &taskInfo[chunk][offset];
+    if (chunk == launchInfo.size())
+        launchInfo.push_back(new LaunchInfo[LAUNCH_CHUNK_SIZE]);
+    return &launchInfo[chunk][offset];
 }
 
 
 inline void *
 TaskGroupBase::AllocMemory(int64_t size, int32_t alignment) {
-    char *basePtr = memBuffers[curMemBuffer];
-    int64_t iptr = (int64_t)(basePtr + curMemBufferOffset);
-    iptr = (iptr + (alignment-1)) & ~(alignment-1);
-
-    int newOffset = int(iptr + size - (int64_t)basePtr);
-    if (newOffset < memBufferSize[curMemBuffer]) {
-        curMemBufferOffset = newOffset;
-        return (char *)iptr;
+    if (arena == NULL) {
+        arena = &tlsArena;
+        arenaMark = arena->GetMark();
     }
-
-    ++curMemBuffer;
-    curMemBufferOffset = 0;
-    assert(curMemBuffer < NUM_MEM_BUFFERS);
-
-    int allocSize = 1 << (12 + curMemBuffer);
-    allocSize = std::max(int(size+alignment), allocSize);
-    char *newBuf = new char[allocSize];
-    memBufferSize[curMemBuffer] = allocSize;
-    memBuffers[curMemBuffer] = newBuf;
-    return AllocMemory(size, alignment);
+    return arena->Alloc(size, alignment);
 }
 
 
@@ -253,6 +402,13 @@ static inline void
 lMemFence() {
     __asm__ __volatile__("mfence":::"memory");
 }
+
+// Spin-wait hint, so a spinning thread yields resources to its
+// hyperthread sibling.
+static inline void
+lPause() {
+    __asm__ __volatile__("pause":::"memory");
+}
 #endif // !ISPC_IS_WINDOWS
 
 
@@ -309,7 +465,7 @@ lAtomicCompareAndSwap32(volatile int32_t *v, int32_t newValue, int32_t oldValue)
 // With ConcRT, we don't need to extend TaskGroupBase at all.
 class TaskGroup : public TaskGroupBase {
 public:
-    void Launch(int baseIndex, int count);
+    void Launch(LaunchInfo *li);
     void Sync();
 };
 #endif // ISPC_USE_CONCRT
@@ -325,7 +481,7 @@ public:
         gcdGroup = dispatch_group_create();
     }
 
-    void Launch(int baseIndex, int count);
+    void Launch(LaunchInfo *li);
     void Sync();
 
 private:
@@ -334,33 +490,32 @@ private:
 #endif // ISPC_USE_GCD
 
 #ifdef ISPC_USE_PTHREADS
-static void *lTaskEntry(void *arg);
+static void lRunLaunch(LaunchInfo *li, int threadIndex, int threadCount);
 
 class TaskGroup : public TaskGroupBase {
 public:
     TaskGroup() {
-        numUnfinishedTasks = 0;
-        waitingTasks.reserve(128);
-        inActiveList = false;
+        syncState = 0;
     }
 
     void Reset() {
         TaskGroupBase::Reset();
-        numUnfinishedTasks = 0;
-        assert(inActiveList == false);
-        lMemFence();
+        syncState = 0;
     }
 
-    void Launch(int baseIndex, int count);
+    void Launch(LaunchInfo *li);
     void Sync();
 
 private:
-    friend void *lTaskEntry(void *arg);
-
-    int32_t numUnfinishedTasks;
-    int32_t pad[3];
-    std::vector<int> waitingTasks;
-    bool inActiveList;
+    friend void lRunLaunch(LaunchInfo *li, int threadIndex, int threadCount);
+
+    // Twice the number of launch tickets (see Launch()) queued or running
+    // and not yet retired, plus one while Sync() is parked on it as a
+    // futex.  Retiring tickets subtract 2 with release ordering, and the
+    // one that finds 3 (the last ticket, with Sync() parked) wakes it
+    // up.  It does so only by address, so it is harmless that Sync() may
+    // have returned and the group been reused by then.
+    std::atomic<int32_t> syncState;
 };
 
 #endif // ISPC_USE_PTHREADS
@@ -397,25 +552,29 @@ InitTaskSystem() {
 
 
 static void
-lRunTask(void *ti) {
-    TaskInfo *taskInfo = (TaskInfo *)ti;
+lRunTask(void *arg, size_t taskIndex) {
+    LaunchInfo *li = (LaunchInfo *)arg;
     // FIXME: these are bogus values; may cause bugs in code that depends
     // on them having unique values in different threads.
     int threadIndex = 0;
     int threadCount = 1;
 
     // Actually run the task
-    taskInfo->func(taskInfo->data, threadIndex, threadCount, 
-                   taskInfo->taskIndex, taskInfo->taskCount);
+    li->func(li->data, threadIndex, threadCount, (int)taskIndex, li->taskCount);
+}
+
+
+static void
+lRunLaunch(void *arg) {
+    // dispatch_apply() splits the index range across the queue's threads.
+    LaunchInfo *li = (LaunchInfo *)arg;
+    dispatch_apply_f(li->taskCount, gcdQueue, li, lRunTask);
 }
 
 
 inline void
-TaskGroup::Launch(int baseIndex, int count) {
-    for (int i = 0; i < count; ++i) {
-        TaskInfo *ti = GetTaskInfo(baseIndex + i);
-        dispatch_group_async_f(gcdGroup, gcdQueue, ti, lRunTask);
-    }
+TaskGroup::Launch(LaunchInfo *li) {
+    dispatch_group_async_f(gcdGroup, gcdQueue, li, lRunLaunch);
 }
 
 
@@ -438,35 +597,48 @@ InitTaskSystem() {
 
 
 static void __cdecl
-lRunTask(LPVOID param) {
-    TaskInfo *ti = (TaskInfo *)param;
+lRunLaunch(LPVOID param) {
+    LaunchInfo *li = (LaunchInfo *)param;
     
-    // Actually run the task. 
+    // Actually run the tasks, taking indices until there are none left.
     // FIXME: like the GCD implementation for OS X, this is passing bogus
     // values for the threadIndex and threadCount builtins, which in turn
     // will cause bugs in code that uses those.
     int threadIndex = 0;
     int threadCount = 1;
-    ti->func(ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount);
+    int64_t taskIndex;
+    while ((taskIndex = li->nextTaskIndex.fetch_add(1)) < li->taskCount)
+        li->func(li->data, threadIndex, threadCount, (int)taskIndex, li->taskCount);
 
-    // Signal the event that this task is done
-    ti->taskEvent.set();
+    // Signal the event once the last of the launch's schedulings is done
+    if (li->numRunning.fetch_sub(1) == 1)
+        li->launchEvent.set();
 }
 
 
 inline void
-TaskGroup::Launch(int baseIndex, int count) {
+TaskGroup::Launch(LaunchInfo *li) {
+    // Schedule the launch once per virtual processor, not once per task;
+    // each scheduling runs tasks until the index range is used up.
+    int count = std::min(li->taskCount,
+                         (int)CurrentScheduler::GetNumberOfVirtualProcessors());
+    if (count <= 0) {
+        li->launchEvent.set();
+        return;
+    }
+    li->nextTaskIndex = 0;
+    li->numRunning = count;
     for (int i = 0; i < count; ++i)
-        CurrentScheduler::ScheduleTask(lRunTask, GetTaskInfo(baseIndex + i));
+        CurrentScheduler::ScheduleTask(lRunLaunch, li);
 }
 
 
 inline void
 TaskGroup::Sync() {
-    for (int i = 0; i < nextTaskInfoIndex; ++i) {
-        TaskInfo *ti = GetTaskInfo(i);
-        ti->taskEvent.wait();
-        ti->taskEvent.reset();
+    for (int i = 0; i < nextLaunchIndex; ++i) {
+        LaunchInfo *li = GetLaunchInfo(i);
+        li->launchEvent.wait();
+        li->launchEvent.reset();
     }
 }
 
@@ -477,97 +649,703 @@ TaskGroup::Sync() {
 
 #ifdef ISPC_USE_PTHREADS
 
+/* A launch is queued as a few "tickets", each a pointer to its
+   LaunchInfo, rather than one entry per task: a thread holding a ticket
+   claims chunks of task indices from the launch's counter until there
+   are none left, then retires the ticket.  A launch gets at most one
+   ticket per thread, so launching millions of tiny tasks costs no more
+   queue traffic than launching a few.
+
+   Each worker thread owns a Chase-Lev work-stealing deque of tickets
+   (Chase and Lev, "Dynamic Circular Work-Stealing Deque", SPAA '05,
+   with the C11 memory orderings of Le et al., PPoPP '13, using seq_cst
+   accesses in place of their fences).  The owner pushes
+   and pops at the bottom without taking any lock; other threads steal
+   from the top with a single compare-and-swap.  Tickets for launches
+   from a worker (nested launches) go on its own deque.  Those for
+   launches from any other thread go on a shared injection deque, whose
+   owner operations are serialized by injectMutex.
+
+   With more than one NUMA node, each launch's index range is split into
+   one contiguous block per node, and a thread works through its own
+   node's block before helping with the others.  Kernels that process
+   an array in task-index order thus mostly touch memory near the thread
+   running them, provided it was first touched by a launch with the same
+   task count.  The environment variables below (read once, when the
+   task system starts) control the workers:
+
+     ISPC_NUM_THREADS=N    run tasks on N threads in all: N-1 workers
+                           plus the thread waiting in Sync().
+     ISPC_NUMA_NODES=LIST  use only the CPUs of these nodes, e.g. "0" or
+                           "0,2-3".  Implies ISPC_AFFINITY=node.
+     ISPC_AFFINITY=MODE    "none" (the default) leaves the workers
+                           unpinned; "node" binds each worker to all of
+                           the CPUs of one node, round-robin; "compact"
+                           pins worker i to the i-th CPU, node by node;
+                           "spread" pins them to CPUs taken from each
+                           node in turn.
+
+   Idle workers sleep on wakeCond.  Every launch bumps launchEpoch once;
+   a worker only goes to sleep if the epoch has not changed since before
+   it last found all of the deques empty, and a launch wakes up to one
+   sleeping worker per ticket with a single lock acquisition.
+ */
+
+class WorkDeque {
+public:
+    WorkDeque() : top(0), bottom(0), array(new Array(1024)) {}
+    ~WorkDeque() {
+        delete array.load();
+        for (size_t i = 0; i < retired.size(); ++i)
+            delete retired[i];
+    }
+
+    // Owner only.
+    void Push(LaunchInfo *li);
+    LaunchInfo *Pop();
+
+    // Any thread.  Returns NULL if the deque is empty or, setting
+    // *lostRace, if another thread took the top entry first.
+    LaunchInfo *Steal(bool *lostRace);
+
+private:
+    struct Array {
+        explicit Array(int64_t n) : size(n), slots(new std::atomic<LaunchInfo *>[n]) {}
+        ~Array() { delete[] slots; }
+
+        LaunchInfo *Get(int64_t i) const {
+            return slots[i & (size-1)].load(std::memory_order_relaxed);
+        }
+        void Put(int64_t i, LaunchInfo *li) {
+            slots[i & (size-1)].store(li, std::memory_order_relaxed);
+        }
+
+        int64_t size;
+        std::atomic<LaunchInfo *> *slots;
+    };
+
+    // top and bottom are written by different threads; keep them on
+    // separate cache lines.
+    std::atomic<int64_t> top;
+    char pad[64];
+    std::atomic<int64_t> bottom;
+    std::atomic<Array *> array;
+
+    // Arrays outgrown by Push(); a thief may still be reading one, so
+    // they are only freed with the deque.
+    std::vector<Array *> retired;
+};
+
+
+inline void
+WorkDeque::Push(LaunchInfo *li) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Array *a = array.load(std::memory_order_relaxed);
+
+    if (b - t > a->size - 1) {
+        // Full: copy the live entries to an array twice the size.
+        Array *grown = new Array(2 * a->size);
+        for (int64_t i = t; i < b; ++i)
+            grown->Put(i, a->Get(i));
+        retired.push_back(a);
+        array.store(grown, std::memory_order_release);
+        a = grown;
+    }
+
+    a->Put(b, li);
+    bottom.store(b + 1, std::memory_order_release);
+}
+
+
+inline LaunchInfo *
+WorkDeque::Pop() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Array *a = array.load(std::memory_order_relaxed);
+    // The store to bottom must be ordered before the load of top (and
+    // the loads in Steal() likewise), hence seq_cst.
+    bottom.store(b, std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_seq_cst);
+
+    if (t > b) {
+        // Empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    LaunchInfo *li = a->Get(b);
+    if (t == b) {
+        // Last entry: race the thieves for it.
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            li = NULL;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return li;
+}
+
+
+inline LaunchInfo *
+WorkDeque::Steal(bool *lostRace) {
+    int64_t t = top.load(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_seq_cst);
+
+    if (t >= b)
+        return NULL;
+
+    Array *a = array.load(std::memory_order_acquire);
+    LaunchInfo *li = a->Get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+        *lostRace = true;
+        return NULL;
+    }
+    return li;
+}
+
+
 static volatile int32_t lock = 0;
 
 static int nThreads;
 static pthread_t *threads = NULL;
 
-static pthread_mutex_t taskSysMutex;
-static std::vector<TaskGroup *> activeTaskGroups;
-static sem_t *workerSemaphore;
+// deques[0..nThreads-1] belong to the workers, deques[nThreads] is the
+// injection deque for launches from other threads.
+static WorkDeque * volatile deques = NULL;
+static pthread_mutex_t injectMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Index of the worker running on this thread, or -1 if this thread is
+// not one of ours.
+static thread_local int tlsWorkerIndex = -1;
+
+/* Tasks see threadCount = nThreads + 1: the workers are threads 0 to
+   nThreads-1, and any other thread running tasks from Sync() is thread
+   nThreads.  Kernels may index per-thread scratch space with
+   threadIndex, so only one such thread at a time may run tasks; it
+   holds externalSlotBusy while it does (and through any nested Sync()
+   in them, tracked by tlsExternalSlotDepth).
+ */
+static std::atomic<bool> externalSlotBusy(false);
+static thread_local int tlsExternalSlotDepth = 0;
+
+enum AffinityMode { AFFINITY_NONE, AFFINITY_NODE, AFFINITY_COMPACT, AFFINITY_SPREAD };
+static const char *affinityNames[] = { "none", "node", "compact", "spread" };
+static AffinityMode affinityMode = AFFINITY_NONE;
+
+// The CPUs we may run on, grouped by NUMA node (after ISPC_NUMA_NODES),
+// and the index in nodeCpus of each CPU's node, or -1.
+static std::vector<std::vector<int> > nodeCpus;
+static std::vector<int> cpuNode;
 
+// The node of the CPUs this worker is bound to, or -1 if it isn't.
+static thread_local int tlsNode = -1;
+static int *workerNodes = NULL;
 
-static inline int32_t 
-lAtomicAdd(int32_t *v, int32_t delta) {
-    int32_t origValue;
-    __asm__ __volatile__("lock\n"
-                         "xaddl %0,%1"
-                         : "=r"(origValue), "=m"(*v) : "0"(delta)
-                         : "memory");
-    return origValue;
+// How long Sync() keeps looking for tasks before it parks (ISPC_SPIN_US,
+// in microseconds).
+static int64_t syncSpinNs = 50 * 1000;
+
+// Time spent waiting, reported at exit if ISPC_TASKSYS_STATS is set.
+static std::atomic<int64_t> syncSpinTotalNs(0), syncSleepTotalNs(0), numSyncParks(0);
+static std::atomic<int64_t> workerSleepTotalNs(0), numWorkerSleeps(0);
+
+static std::atomic<uint32_t> launchEpoch(0);
+static std::atomic<int32_t> nSleeping(0);
+static pthread_mutex_t sleepMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+
+
+static inline int64_t
+lNanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 
-static void *
-lTaskEntry(void *arg) {
-    int threadIndex = (int)((int64_t)arg);
-    int threadCount = nThreads;
+static inline void
+lFutexWait(std::atomic<int32_t> *addr, int32_t value) {
+    // Returns at once if *addr != value; EINTR and spurious wakeups are
+    // left to the caller's loop.
+    syscall(SYS_futex, (int32_t *)addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
 
-    while (1) {
-        int err;
-        //
-        // Wait on the semaphore until we're woken up due to the arrival of
-        // more work.
-        //
-        if ((err = sem_wait(workerSemaphore)) != 0) {
-            fprintf(stderr, "Error from sem_wait: %s\n", strerror(err));
-            exit(1);
+
+static inline void
+lFutexWake(std::atomic<int32_t> *addr) {
+    syscall(SYS_futex, (int32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+
+static void
+lLock(pthread_mutex_t *mutex) {
+    int err;
+    if ((err = pthread_mutex_lock(mutex)) != 0) {
+        fprintf(stderr, "Error from pthread_mutex_lock: %s\n", strerror(err));
+        exit(1);
+    }
+}
+
+
+static void
+lUnlock(pthread_mutex_t *mutex) {
+    int err;
+    if ((err = pthread_mutex_unlock(mutex)) != 0) {
+        fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
+        exit(1);
+    }
+}
+
+
+static void
+lPrintStats() {
+    fprintf(stderr, "tasksys: %d threads, %d NUMA nodes, affinity %s\n",
+            nThreads + 1, (int)nodeCpus.size(), affinityNames[affinityMode]);
+    fprintf(stderr, "tasksys: sync spun %.3f ms, slept %.3f ms in %lld parks; "
+            "workers slept %.3f ms in %lld waits\n",
+            syncSpinTotalNs.load() * 1e-6, syncSleepTotalNs.load() * 1e-6,
+            (long long)numSyncParks.load(),
+            workerSleepTotalNs.load() * 1e-6, (long long)numWorkerSleeps.load());
+    int64_t groups = numAllocGroups.load();
+    fprintf(stderr, "tasksys: ISPCAlloc in %lld groups, %.1f KB average, %.1f KB peak; "
+            "%.1f KB peak per thread, %lld blocks from the heap\n",
+            (long long)groups, groups > 0 ? totalGroupBytes.load() / 1024.0 / groups : 0.0,
+            peakGroupBytes.load() / 1024.0, peakArenaBytes.load() / 1024.0,
+            (long long)numArenaBlocks.load());
+}
+
+
+/* Tracing.  If ISPC_TRACE names a file, each thread that runs tasks
+   records what it does in a ring buffer of its own (keeping the last
+   TRACE_BUFFER_EVENTS events), with CycleTimer::currentTicks()
+   timestamps, and the buffers are written to the file at exit in the
+   Chrome trace event JSON format, which chrome://tracing and Perfetto
+   (ui.perfetto.dev) load.  The recorded events are:
+
+     launch N        a launch (numbered in order), with its task and
+                     ticket counts
+     launch N tasks  a chunk of launch N's tasks, [first, last)
+     steal           a ticket taken from another thread's deque
+     sync            a whole Sync(), with the number of times it parked
+     sleep           a worker waiting for launches
+
+   Without ISPC_TRACE, each of these costs one test of a flag.
+ */
+#define TRACE_BUFFER_EVENTS (1 << 16)
+
+enum TraceEventType { TRACE_LAUNCH, TRACE_TASKS, TRACE_STEAL, TRACE_SYNC, TRACE_SLEEP };
+
+struct TraceEvent {
+    CycleTimer::SysClock start, end;
+    int type, launch;
+    int64_t arg0, arg1;
+};
+
+struct TraceBuffer {
+    int tid;
+    // Events recorded so far; the newest TRACE_BUFFER_EVENTS are kept.
+    std::atomic<uint64_t> count;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+// Set once by InitTaskSystem() and cleared by lWriteTrace(), while
+// other threads test it; lTracing() is the cheap relaxed read.
+static std::atomic<bool> tracing(false);
+// Threads inside lTrace(); lWriteTrace() waits for them to leave.
+static std::atomic<int> numTraceWriters(0);
+static const char *tracePath = NULL;
+static CycleTimer::SysClock traceStartTicks;
+static std::atomic<int> numTracedLaunches(0);
+static std::vector<TraceBuffer *> traceBuffers;
+static int numTracedOtherThreads = 0;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_local TraceBuffer *tlsTraceBuffer = NULL;
+
+static inline bool
+lTracing() {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+static void
+lTrace(int type, CycleTimer::SysClock start, int launch, int64_t arg0, int64_t arg1) {
+    // Announce the write before checking the flag again, so that
+    // lWriteTrace() (which clears the flag, then waits for the count to
+    // drop) either sees us or makes us back off.
+    numTraceWriters.fetch_add(1);
+    if (!tracing.load()) {
+        numTraceWriters.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    TraceBuffer *buf = tlsTraceBuffer;
+    if (buf == NULL) {
+        // First event from this thread.  Workers keep their index as the
+        // trace's thread id; other threads are numbered after them.
+        buf = new TraceBuffer;
+        buf->count = 0;
+        lLock(&traceMutex);
+        buf->tid = tlsWorkerIndex >= 0 ? tlsWorkerIndex : nThreads + numTracedOtherThreads++;
+        traceBuffers.push_back(buf);
+        lUnlock(&traceMutex);
+        tlsTraceBuffer = buf;
+    }
+
+    uint64_t n = buf->count.load(std::memory_order_relaxed);
+    TraceEvent &e = buf->events[n % TRACE_BUFFER_EVENTS];
+    e.start = start;
+    e.end = CycleTimer::currentTicks();
+    e.type = type;
+    e.launch = launch;
+    e.arg0 = arg0;
+    e.arg1 = arg1;
+    buf->count.store(n + 1, std::memory_order_release);
+    numTraceWriters.fetch_sub(1, std::memory_order_release);
+}
+
+
+static void
+lWriteTrace() {
+    // Workers may still be running tasks at exit.  Stop recording, and
+    // wait for any event that is being written to be finished, so that
+    // the buffers no longer change while we read them.
+    tracing.store(false);
+    while (numTraceWriters.load(std::memory_order_acquire) != 0)
+        sched_yield();
+
+    FILE *f = fopen(tracePath, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Couldn't open trace file \"%s\": %s\n", tracePath, strerror(errno));
+        return;
+    }
+
+    double usPerTick = CycleTimer::secondsPerTick() * 1e6;
+    const char *sep = "";
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+    lLock(&traceMutex);
+    for (size_t b = 0; b < traceBuffers.size(); ++b) {
+        TraceBuffer *buf = traceBuffers[b];
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+                "\"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+                sep, buf->tid, buf->tid < nThreads ? "worker" : "thread", buf->tid);
+        sep = ",\n";
+
+        uint64_t count = buf->count.load(std::memory_order_acquire);
+        uint64_t first = count > TRACE_BUFFER_EVENTS ? count - TRACE_BUFFER_EVENTS : 0;
+        for (uint64_t i = first; i < count; ++i) {
+            const TraceEvent &e = buf->events[i % TRACE_BUFFER_EVENTS];
+            double ts = ((int64_t)(e.start - traceStartTicks)) * usPerTick;
+            double dur = ((int64_t)(e.end - e.start)) * usPerTick;
+            fprintf(f, "%s{\"pid\": 0, \"tid\": %d, \"ts\": %.3f, ", sep, buf->tid, ts);
+            switch (e.type) {
+            case TRACE_LAUNCH:
+                fprintf(f, "\"ph\": \"i\", \"s\": \"t\", \"name\": \"launch %d\", "
+                        "\"args\": {\"tasks\": %lld, \"tickets\": %lld}}",
+                        e.launch, (long long)e.arg0, (long long)e.arg1);
+                break;
+            case TRACE_TASKS:
+                fprintf(f, "\"ph\": \"X\", \"dur\": %.3f, \"name\": \"launch %d tasks\", "
+                        "\"args\": {\"first\": %lld, \"last\": %lld}}",
+                        dur, e.launch, (long long)e.arg0, (long long)e.arg1);
+                break;
+            case TRACE_STEAL:
+                fprintf(f, "\"ph\": \"i\", \"s\": \"t\", \"name\": \"steal\", "
+                        "\"args\": {\"launch\": %d, \"victim\": %lld}}",
+                        e.launch, (long long)e.arg0);
+                break;
+            case TRACE_SYNC:
+                fprintf(f, "\"ph\": \"X\", \"dur\": %.3f, \"name\": \"sync\", "
+                        "\"args\": {\"parks\": %lld}}", dur, (long long)e.arg0);
+                break;
+            default:
+                fprintf(f, "\"ph\": \"X\", \"dur\": %.3f, \"name\": \"sleep\"}", dur);
+                break;
+            }
         }
+    }
+    lUnlock(&traceMutex);
 
-        //
-        // Acquire the mutex
-        //
-        if ((err = pthread_mutex_lock(&taskSysMutex)) != 0) {
-            fprintf(stderr, "Error from pthread_mutex_lock: %s\n", strerror(err));
-            exit(1);
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    fprintf(stderr, "tasksys: wrote trace to %s\n", tracePath);
+}
+
+
+/* Parses a Linux CPU or node list such as "0-3,8,10-11" into *values.
+   Returns false if it is malformed.
+ */
+static bool
+lParseList(const char *str, std::vector<int> *values) {
+    const char *p = str;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p || first < 0)
+            return false;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+                return false;
+            p = end;
         }
+        for (long v = first; v <= last; ++v)
+            values->push_back((int)v);
+        if (*p == ',')
+            ++p;
+        else if (*p != '\0' && *p != '\n')
+            return false;
+    }
+    return true;
+}
 
-        if (activeTaskGroups.size() == 0) {
-            //
-            // Task queue is empty, go back and wait on the semaphore
-            //
-            if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
-                fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
-                exit(1);
-            }
+
+static bool
+lReadList(const char *path, std::vector<int> *values) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), f) != NULL && lParseList(buf, values);
+    fclose(f);
+    return ok;
+}
+
+
+/* Fills in nodeCpus and cpuNode from sysfs, keeping only the CPUs in
+   this process's affinity mask and the nodes in ISPC_NUMA_NODES (if
+   set).  Without NUMA information, all of the CPUs form one node.
+   Returns true if ISPC_NUMA_NODES restricted the nodes.
+ */
+static bool
+lInitTopology() {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+            CPU_SET(i, &allowed);
+    }
+
+    std::vector<int> nodes, wanted;
+    const char *wantedEnv = getenv("ISPC_NUMA_NODES");
+    if (wantedEnv != NULL && !lParseList(wantedEnv, &wanted)) {
+        fprintf(stderr, "Ignoring malformed ISPC_NUMA_NODES \"%s\"\n", wantedEnv);
+        wantedEnv = NULL;
+    }
+    if (!lReadList("/sys/devices/system/node/online", &nodes))
+        nodes.clear();
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (wantedEnv != NULL &&
+            std::find(wanted.begin(), wanted.end(), nodes[i]) == wanted.end())
+            continue;
+        char path[128];
+        std::vector<int> cpus, usable;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+        if (!lReadList(path, &cpus))
             continue;
+        for (size_t j = 0; j < cpus.size(); ++j)
+            if (cpus[j] < CPU_SETSIZE && CPU_ISSET(cpus[j], &allowed))
+                usable.push_back(cpus[j]);
+        if (!usable.empty())
+            nodeCpus.push_back(usable);
+    }
+
+    if (nodeCpus.empty()) {
+        if (wantedEnv != NULL)
+            fprintf(stderr, "No usable CPUs on ISPC_NUMA_NODES \"%s\"; using all nodes\n",
+                    wantedEnv);
+        std::vector<int> cpus;
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+            if (CPU_ISSET(i, &allowed))
+                cpus.push_back(i);
+        nodeCpus.push_back(cpus);
+        wantedEnv = NULL;
+    }
+
+    for (size_t n = 0; n < nodeCpus.size(); ++n)
+        for (size_t j = 0; j < nodeCpus[n].size(); ++j) {
+            int cpu = nodeCpus[n][j];
+            if (cpu >= (int)cpuNode.size())
+                cpuNode.resize(cpu + 1, -1);
+            cpuNode[cpu] = (int)n;
         }
+    return wantedEnv != NULL;
+}
+
+
+/* Returns the CPUs worker i should run on, in *set, and their node, or
+   -1 (and an empty set) if it is not to be pinned.
+ */
+static int
+lWorkerAffinity(int i, cpu_set_t *set) {
+    CPU_ZERO(set);
+    int numNodes = (int)nodeCpus.size();
+
+    if (affinityMode == AFFINITY_NODE) {
+        int node = i % numNodes;
+        for (size_t j = 0; j < nodeCpus[node].size(); ++j)
+            CPU_SET(nodeCpus[node][j], set);
+        return node;
+    }
 
-        //
-        // Get the last task group on the active list and the last task
-        // from its waiting tasks list.
-        //
-        TaskGroup *tg = activeTaskGroups.back();
-        assert(tg->waitingTasks.size() > 0);
-        int taskNumber = tg->waitingTasks.back();
-        tg->waitingTasks.pop_back();
-
-        if (tg->waitingTasks.size() == 0) {
-            // We just took the last task from this task group, so remove
-            // it from the active list.
-            activeTaskGroups.pop_back();
-            tg->inActiveList = false;
+    if (affinityMode == AFFINITY_COMPACT || affinityMode == AFFINITY_SPREAD) {
+        std::vector<int> order;
+        if (affinityMode == AFFINITY_COMPACT)
+            for (int n = 0; n < numNodes; ++n)
+                order.insert(order.end(), nodeCpus[n].begin(), nodeCpus[n].end());
+        else {
+            size_t most = 0;
+            for (int n = 0; n < numNodes; ++n)
+                most = std::max(most, nodeCpus[n].size());
+            for (size_t j = 0; j < most; ++j)
+                for (int n = 0; n < numNodes; ++n)
+                    if (j < nodeCpus[n].size())
+                        order.push_back(nodeCpus[n][j]);
         }
-    
-        if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
-            fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
-            exit(1);
+        int cpu = order[i % order.size()];
+        CPU_SET(cpu, set);
+        return cpuNode[cpu];
+    }
+
+    return -1;
+}
+
+
+// The NUMA node the calling thread is running on.
+static inline int
+lCurrentNode() {
+    if (nodeCpus.size() == 1)
+        return 0;
+    if (tlsNode >= 0)
+        return tlsNode;
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < (int)cpuNode.size() && cpuNode[cpu] >= 0)
+        return cpuNode[cpu];
+    return 0;
+}
+
+
+/* Takes a ticket for worker workerIndex (-1 for other threads): first
+   from its own deque (the injection deque for other threads), then by
+   stealing from the others, starting with its neighbor.  Returns NULL
+   once every deque was seen empty.
+ */
+static LaunchInfo *
+lGetLaunch(int workerIndex) {
+    LaunchInfo *li;
+    if (workerIndex >= 0)
+        li = deques[workerIndex].Pop();
+    else {
+        lLock(&injectMutex);
+        li = deques[nThreads].Pop();
+        lUnlock(&injectMutex);
+    }
+    if (li != NULL)
+        return li;
+
+    int numDeques = nThreads + 1;
+    int start = workerIndex >= 0 ? workerIndex + 1 : 0;
+    bool lostRace;
+    do {
+        lostRace = false;
+        for (int i = 0; i < numDeques; ++i) {
+            int victim = (start + i) % numDeques;
+            if (victim == workerIndex)
+                continue;
+            if ((li = deques[victim].Steal(&lostRace)) != NULL) {
+                if (lTracing())
+                    lTrace(TRACE_STEAL, CycleTimer::currentTicks(), li->traceId, victim, 0);
+                return li;
+            }
+        }
+    } while (lostRace);
+
+    return NULL;
+}
+
+
+/* Runs tasks of launch li until its indices are used up, then retires
+   the caller's ticket.  Indices are claimed in chunks of about
+   1/(LAUNCH_CHUNKS_PER_THREAD * threads) of those remaining in a block,
+   so there is one atomic add per task for small launches (where each
+   task is usually big, and balancing them matters), and few for huge
+   ones.  The block of the caller's NUMA node comes first.
+ */
+#define LAUNCH_CHUNKS_PER_THREAD 8
+
+static inline void
+lRunLaunch(LaunchInfo *li, int threadIndex, int threadCount) {
+    DBG(fprintf(stderr, "running launch %p from group %p\n", li, li->taskGroup));
+    TaskGroup *tg = li->taskGroup;
+    int taskCount = li->taskCount;
+    int numBlocks = li->numBlocks;
+    int64_t divisor = (int64_t)LAUNCH_CHUNKS_PER_THREAD * (nThreads + 1);
+    int home = lCurrentNode() % numBlocks;
+
+    for (int b = 0; b < numBlocks; ++b) {
+        TaskBlock &block = li->blocks[(home + b) % numBlocks];
+        while (1) {
+            int64_t next = block.next.load(std::memory_order_relaxed);
+            if (next >= block.end)
+                break;
+            int64_t chunk = std::max((block.end - next) / divisor, (int64_t)1);
+            int64_t first = block.next.fetch_add(chunk, std::memory_order_relaxed);
+            int64_t last = std::min(first + chunk, block.end);
+            if (first >= last)
+                break;
+            CycleTimer::SysClock start = lTracing() ? CycleTimer::currentTicks() : 0;
+            for (int64_t i = first; i < last; ++i)
+                li->func(li->data, threadIndex, threadCount, (int)i, taskCount);
+            if (lTracing())
+                lTrace(TRACE_TASKS, start, li->traceId, first, last);
         }
+    }
+
+    // Release the tasks' writes to the thread waiting in Sync(), and
+    // wake it if it is parked and this was the last ticket.  Every task
+    // index was claimed by some ticket, so the tasks are all done once
+    // the tickets are.
+    if (tg->syncState.fetch_sub(2, std::memory_order_acq_rel) == 3)
+        lFutexWake(&tg->syncState);
+}
+
 
-        //
-        // And now actually run the task
-        //
-        DBG(fprintf(stderr, "running task %d from group %p\n", taskNumber, tg));
-        TaskInfo *myTask = tg->GetTaskInfo(taskNumber);
-        myTask->func(myTask->data, threadIndex, threadCount, myTask->taskIndex,
-                     myTask->taskCount);
+static void *
+lTaskEntry(void *arg) {
+    int threadIndex = (int)((int64_t)arg);
+    int threadCount = nThreads + 1;
+    tlsWorkerIndex = threadIndex;
+    tlsNode = workerNodes[threadIndex];
+
+    while (1) {
+        // Read the epoch before looking for work, so that a launch after
+        // the search below keeps us from going to sleep.
+        uint32_t epoch = launchEpoch.load();
 
-        //
-        // Decrement the "number of unfinished tasks" counter in the task
-        // group.
-        //
-        lMemFence();
-        lAtomicAdd(&tg->numUnfinishedTasks, -1);
+        LaunchInfo *li = lGetLaunch(threadIndex);
+        if (li != NULL) {
+            lRunLaunch(li, threadIndex, threadCount);
+            continue;
+        }
+
+        int64_t sleepStart = lNanoseconds();
+        CycleTimer::SysClock traceStart = lTracing() ? CycleTimer::currentTicks() : 0;
+        lLock(&sleepMutex);
+        nSleeping.fetch_add(1);
+        while (launchEpoch.load() == epoch) {
+            int err;
+            if ((err = pthread_cond_wait(&wakeCond, &sleepMutex)) != 0) {
+                fprintf(stderr, "Error from pthread_cond_wait: %s\n", strerror(err));
+                exit(1);
+            }
+        }
+        nSleeping.fetch_sub(1);
+        lUnlock(&sleepMutex);
+        workerSleepTotalNs += lNanoseconds() - sleepStart;
+        ++numWorkerSleeps;
+        if (lTracing())
+            lTrace(TRACE_SLEEP, traceStart, 0, 0, 0);
     }
 
     pthread_exit(NULL);
@@ -577,39 +1355,83 @@ lTaskEntry(void *arg) {
 
 static void
 InitTaskSystem() {
-    if (threads == NULL) {
+    if (deques == NULL) {
         while (1) {
             if (lAtomicCompareAndSwap32(&lock, 1, 0) == 0) {
-                if (threads == NULL) {
-                    // We launch one fewer thread than there are cores,
-                    // since the main thread here will also grab jobs from
-                    // the task queue itself.
-                    nThreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
-
-                    int err;
-                    if ((err = pthread_mutex_init(&taskSysMutex, NULL)) != 0) {
-                        fprintf(stderr, "Error creating mutex: %s\n", strerror(err));
-                        exit(1);
+                if (deques == NULL) {
+                    bool nodesRestricted = lInitTopology();
+
+                    // We launch one fewer thread than there are cores
+                    // (of the nodes asked for), since the main thread
+                    // here will also grab jobs from the task queue
+                    // itself.
+                    const char *numThreads = getenv("ISPC_NUM_THREADS");
+                    if (numThreads != NULL)
+                        nThreads = std::max(atoi(numThreads), 1) - 1;
+                    else if (nodesRestricted) {
+                        nThreads = -1;
+                        for (size_t n = 0; n < nodeCpus.size(); ++n)
+                            nThreads += (int)nodeCpus[n].size();
+                    }
+                    else
+                        nThreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+                    const char *affinity = getenv("ISPC_AFFINITY");
+                    if (nodesRestricted)
+                        affinityMode = AFFINITY_NODE;
+                    if (affinity != NULL) {
+                        int m;
+                        for (m = 0; m < 4; ++m)
+                            if (strcmp(affinity, affinityNames[m]) == 0)
+                                break;
+                        if (m < 4)
+                            affinityMode = (AffinityMode)m;
+                        else
+                            fprintf(stderr, "Ignoring unknown ISPC_AFFINITY \"%s\"\n", affinity);
                     }
 
-                    char name[32];
-                    sprintf(name, "ispc_task.%d", (int)getpid());
-                    workerSemaphore = sem_open(name, O_CREAT, S_IRUSR|S_IWUSR, 0);
-                    if (!workerSemaphore) {
-                        fprintf(stderr, "Error creating semaphore: %s\n", strerror(err));
-                        exit(1);
+                    const char *spin = getenv("ISPC_SPIN_US");
+                    if (spin != NULL)
+                        syncSpinNs = std::max(0L, atol(spin)) * 1000;
+                    if (getenv("ISPC_TASKSYS_STATS") != NULL)
+                        atexit(lPrintStats);
+                    tracePath = getenv("ISPC_TRACE");
+                    if (tracePath != NULL && tracePath[0] != '\0') {
+                        traceStartTicks = CycleTimer::currentTicks();
+                        tracing.store(true);
+                        atexit(lWriteTrace);
                     }
 
+                    // Publish the deques (and nThreads) before starting
+                    // the workers; launches may use them right away.
+                    WorkDeque *newDeques = new WorkDeque[nThreads + 1];
+                    lMemFence();
+                    deques = newDeques;
+
                     threads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
+                    workerNodes = (int *)malloc(nThreads * sizeof(int));
                     for (intptr_t i = 0; i < nThreads; ++i) {
-                        err = pthread_create(&threads[i], NULL, &lTaskEntry, (void *) i);
+                        // Pin the worker from the start, so that its
+                        // stack is first touched on its own node.
+                        pthread_attr_t attr;
+                        cpu_set_t cpus;
+                        pthread_attr_init(&attr);
+                        workerNodes[i] = lWorkerAffinity((int)i, &cpus);
+                        if (workerNodes[i] >= 0) {
+                            int err = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+                            if (err != 0) {
+                                fprintf(stderr, "Error from pthread_attr_setaffinity_np: %s\n",
+                                        strerror(err));
+                                exit(1);
+                            }
+                        }
+                        int err = pthread_create(&threads[i], &attr, &lTaskEntry, (void *) i);
                         if (err != 0) {
                             fprintf(stderr, "Error creating pthread %lu: %s\n", i, strerror(err));
                             exit(1);
                         }
+                        pthread_attr_destroy(&attr);
                     }
-
-                    activeTaskGroups.reserve(64);
                 }
 
                 // Make sure all of the above goes to memory before we
@@ -624,148 +1446,147 @@ InitTaskSystem() {
 
 
 inline void
-TaskGroup::Launch(int baseCoord, int count) {
+TaskGroup::Launch(LaunchInfo *li) {
     //
-    // Acquire mutex, add task
+    // One ticket per thread that could usefully work on the launch,
+    // counted before any of them can be retired.
     //
-    int err;
-    if ((err = pthread_mutex_lock(&taskSysMutex)) != 0) {
-        fprintf(stderr, "Error from pthread_mutex_lock: %s\n", strerror(err));
-        exit(1);
+    int count = std::min(li->taskCount, nThreads + 1);
+    if (count <= 0)
+        return;
+    li->taskGroup = this;
+    if (lTracing()) {
+        li->traceId = ++numTracedLaunches;
+        lTrace(TRACE_LAUNCH, CycleTimer::currentTicks(), li->traceId, li->taskCount, count);
     }
 
-    // Add the corresponding set of tasks to the waiting-to-be-run list for
-    // this task group.
-    //
-    // FIXME: it's a little ugly to hold a global mutex for this when we
-    // only need to make sure no one else is accessing this task group's
-    // waitingTasks list.  (But a small experiment in switching to a
-    // per-TaskGroup mutex showed worse performance!)
-    for (int i = 0; i < count; ++i)
-        waitingTasks.push_back(baseCoord + i);
-
-    // Add the task group to the global active list if it isn't there
-    // already.
-    if (inActiveList == false) {
-        activeTaskGroups.push_back(this);
-        inActiveList = true;
+    // Split the indices into one block per node, in node order.
+    int numBlocks = std::min(li->taskCount,
+                             std::min((int)nodeCpus.size(), MAX_NUMA_NODES));
+    li->numBlocks = numBlocks;
+    for (int b = 0; b < numBlocks; ++b) {
+        li->blocks[b].next.store((int64_t)li->taskCount * b / numBlocks,
+                                 std::memory_order_relaxed);
+        li->blocks[b].end = (int64_t)li->taskCount * (b + 1) / numBlocks;
     }
 
-    if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
-        fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
-        exit(1);
-    }
+    syncState.fetch_add(2 * count);
 
-    //
-    // Update the count of the number of tasks left to run in this task
-    // group.
-    //
-    lMemFence();
-    lAtomicAdd(&numUnfinishedTasks, count);
+    int workerIndex = tlsWorkerIndex;
+    if (workerIndex < 0)
+        lLock(&injectMutex);
+
+    WorkDeque &deque = deques[workerIndex >= 0 ? workerIndex : nThreads];
+    for (int i = 0; i < count; ++i)
+        deque.Push(li);
+
+    if (workerIndex < 0)
+        lUnlock(&injectMutex);
 
     //
-    // Post to the worker semaphore to wake up worker threads that are
-    // sleeping waiting for tasks to show up
+    // Wake up sleeping workers, as many as there are new tickets, with one
+    // lock acquisition.  (See lTaskEntry() for why bumping the epoch
+    // first makes it safe to skip this when nobody is asleep.)
     //
-    for (int i = 0; i < count; ++i)
-        if ((err = sem_post(workerSemaphore)) != 0) {
-            fprintf(stderr, "Error from sem_post: %s\n", strerror(err));
-            exit(1);
-        }
+    launchEpoch.fetch_add(1);
+    int32_t sleeping = nSleeping.load();
+    if (sleeping > 0) {
+        lLock(&sleepMutex);
+        if (count >= sleeping)
+            pthread_cond_broadcast(&wakeCond);
+        else
+            for (int i = 0; i < count; ++i)
+                pthread_cond_signal(&wakeCond);
+        lUnlock(&sleepMutex);
+    }
 }
 
 
 inline void
 TaskGroup::Sync() {
-    DBG(fprintf(stderr, "syncing %p - %d unfinished\n", tg, numUnfinishedTasks));
+    DBG(fprintf(stderr, "syncing %p - %d unfinished\n", this, syncState.load() / 2));
 
-    while (numUnfinishedTasks > 0) {
-        // All of the tasks in this group aren't finished yet.  We'll try
-        // to help out here since we don't have anything else to do...
+    CycleTimer::SysClock traceStart = lTracing() ? CycleTimer::currentTicks() : 0;
 
-        DBG(fprintf(stderr, "while syncing %p - %d unfinished\n", tg, 
-                    numUnfinishedTasks));
+    // When we last ran out of tasks to run, or -1 while we have work.
+    int64_t idleSince = -1;
+    int64_t spinNs = 0, sleepNs = 0, numParks = 0;
 
-        //
-        // Acquire the global task system mutex to grab a task to work on
-        //
-        int err;
-        if ((err = pthread_mutex_lock(&taskSysMutex)) != 0) {
-            fprintf(stderr, "Error from pthread_mutex_lock: %s\n", strerror(err));
-            exit(1);
-        }
+    while (1) {
+        int32_t state = syncState.load(std::memory_order_acquire);
+        if (state < 2)
+            break;
 
-        TaskInfo *myTask = NULL;
-        TaskGroup *runtg = this;
-        if (waitingTasks.size() > 0) {
-            int taskNumber = waitingTasks.back();
-            waitingTasks.pop_back();
-
-            if (waitingTasks.size() == 0) {
-                // There's nothing left to start running from this group,
-                // so remove it from the active task list.
-                activeTaskGroups.erase(std::find(activeTaskGroups.begin(),
-                                                 activeTaskGroups.end(), this));
-                inActiveList = false;
-            }
-            myTask = GetTaskInfo(taskNumber);
-            DBG(fprintf(stderr, "running task %d from group %p in sync\n", taskNumber, tg));
-        }
-        else {
-            // Other threads are already working on all of the tasks in
-            // this group, so we can't help out by running one ourself.
-            // We'll try to run one from another group to make ourselves
-            // useful here.
-            if (activeTaskGroups.size() == 0) {
-                // No active task groups left--there's nothing for us to do.
-                if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
-                    fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
-                    exit(1);
+        // All of the tasks in this group aren't finished yet.  We'll try
+        // to help out here since we don't have anything else to do,
+        // running tasks from this or any other group.  Our own deque
+        // comes first, so a task waiting on a nested launch runs its
+        // children itself before taking anything else.
+        int threadIndex = tlsWorkerIndex;
+        bool tookSlot = false;
+        if (threadIndex < 0) {
+            threadIndex = nThreads;
+            if (tlsExternalSlotDepth == 0) {
+                if (externalSlotBusy.exchange(true, std::memory_order_acquire)) {
+                    // Another thread is running tasks as thread
+                    // nThreads.  Leave the tasks to it and the workers;
+                    // without workers, it may need to come back for ours,
+                    // so don't park.
+                    if (nThreads == 0) {
+                        sched_yield();
+                        continue;
+                    }
+                    threadIndex = -1;
                 }
-                // FIXME: We basically end up busy-waiting here, which is
-                // extra wasteful in a world with hyperthreading.  It would
-                // be much better to put this thread to sleep on a
-                // condition variable that was signaled when the last task
-                // in this group was finished.
-                sleep(0);
-                continue;
+                else
+                    tookSlot = true;
             }
+        }
 
-            // Get a task to run from another task group.
-            runtg = activeTaskGroups.back();
-            assert(runtg->waitingTasks.size() > 0);
-
-            int taskNumber = runtg->waitingTasks.back();
-            runtg->waitingTasks.pop_back();
-            if (runtg->waitingTasks.size() == 0) {
-                // There's left to start running from this group, so remove
-                // it from the active task list.
-                activeTaskGroups.pop_back();
-                runtg->inActiveList = false;
+        LaunchInfo *li = threadIndex >= 0 ? lGetLaunch(tlsWorkerIndex) : NULL;
+        if (li != NULL) {
+            if (idleSince >= 0) {
+                spinNs += lNanoseconds() - idleSince;
+                idleSince = -1;
             }
-            myTask = runtg->GetTaskInfo(taskNumber);
-            DBG(fprintf(stderr, "running task %d from other group %p in sync\n", 
-                        taskNumber, runtg));
+            ++tlsExternalSlotDepth;
+            lRunLaunch(li, threadIndex, nThreads + 1);
+            --tlsExternalSlotDepth;
         }
+        if (tookSlot)
+            externalSlotBusy.store(false, std::memory_order_release);
+        if (li != NULL)
+            continue;
 
-        if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
-            fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
-            exit(1);
+        // Other threads are running the rest of this group.  Spin for a
+        // while, in case they finish soon...
+        int64_t now = lNanoseconds();
+        if (idleSince < 0)
+            idleSince = now;
+        if (now - idleSince < syncSpinNs) {
+            lPause();
+            continue;
         }
-    
-        //
-        // Do work for _myTask_
-        //
-        // FIXME: bogus values for thread index/thread count here as well..
-        myTask->func(myTask->data, 0, 1, myTask->taskIndex, myTask->taskCount);
 
-        //
-        // Decrement the number of unfinished tasks counter
-        //
-        lMemFence();
-        lAtomicAdd(&runtg->numUnfinishedTasks, -1);
+        // ...then park until the last of them wakes us up.
+        if ((state & 1) == 0 &&
+            !syncState.compare_exchange_weak(state, state | 1))
+            continue;
+        spinNs += now - idleSince;
+        lFutexWait(&syncState, state | 1);
+        idleSince = lNanoseconds();
+        sleepNs += idleSince - now;
+        ++numParks;
     }
-    DBG(fprintf(stderr, "sync for %p done!n", tg));
+
+    if (idleSince >= 0)
+        spinNs += lNanoseconds() - idleSince;
+    syncSpinTotalNs += spinNs;
+    syncSleepTotalNs += sleepNs;
+    numSyncParks += numParks;
+    if (lTracing())
+        lTrace(TRACE_SYNC, traceStart, 0, numParks, 0);
+    DBG(fprintf(stderr, "sync for %p done!n", this));
 }
 
 #endif // ISPC_USE_PTHREADS
@@ -827,15 +1648,11 @@ ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count) {
     else
         taskGroup = (TaskGroup *)(*taskGroupPtr);
 
-    int baseIndex = taskGroup->AllocTaskInfo(count);
-    for (int i = 0; i < count; ++i) {
-        TaskInfo *ti = taskGroup->GetTaskInfo(baseIndex+i);
-        ti->func = (TaskFuncType)func;
-        ti->data = data;
-        ti->taskIndex = i;
-        ti->taskCount = count;
-    }
-    taskGroup->Launch(baseIndex, count);
+    LaunchInfo *li = taskGroup->GetLaunchInfo(taskGroup->AllocLaunchInfo());
+    li->func = (TaskFuncType)func;
+    li->data = data;
+    li->taskCount = count;
+    taskGroup->Launch(li);
 }
 
 
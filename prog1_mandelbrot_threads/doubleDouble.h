@@ -0,0 +1,68 @@
+#ifndef DOUBLE_DOUBLE_H_
+#define DOUBLE_DOUBLE_H_
+
+#include <math.h>
+
+/** DoubleDouble is the unevaluated sum hi + lo of two doubles, with lo no
+    larger than half an ulp of hi: about 106 bits, or 32 decimal digits,
+    of mantissa with the exponent range of double.
+
+    The operations are built from error-free transformations (two-sum,
+    and a two-product through fma()), which rely on every double
+    operation being rounded exactly as written.  Do not build with
+    -ffast-math; the Makefile's -ffp-contract=off keeps the compiler from
+    fusing the additions.
+ */
+struct DoubleDouble {
+    double hi, lo;
+
+    DoubleDouble() : hi(0.), lo(0.) {}
+    DoubleDouble(double x) : hi(x), lo(0.) {}
+    DoubleDouble(double hi, double lo) : hi(hi), lo(lo) {}
+
+    double toDouble() const { return hi + lo; }
+};
+
+// a + b = s + e exactly, for any a and b
+inline DoubleDouble ddTwoSum(double a, double b) {
+    double s = a + b;
+    double bb = s - a;
+    double e = (a - (s - bb)) + (b - bb);
+    return DoubleDouble(s, e);
+}
+
+// a + b = s + e exactly, for |a| >= |b|
+inline DoubleDouble ddQuickTwoSum(double a, double b) {
+    double s = a + b;
+    double e = b - (s - a);
+    return DoubleDouble(s, e);
+}
+
+inline DoubleDouble operator-(const DoubleDouble &a) {
+    return DoubleDouble(-a.hi, -a.lo);
+}
+
+inline DoubleDouble operator+(const DoubleDouble &a, const DoubleDouble &b) {
+    DoubleDouble s = ddTwoSum(a.hi, b.hi);
+    DoubleDouble t = ddTwoSum(a.lo, b.lo);
+    s = ddQuickTwoSum(s.hi, s.lo + t.hi);
+    return ddQuickTwoSum(s.hi, s.lo + t.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble &a, const DoubleDouble &b) {
+    return a + -b;
+}
+
+inline DoubleDouble operator*(const DoubleDouble &a, const DoubleDouble &b) {
+    double p = a.hi * b.hi;
+    double e = fma(a.hi, b.hi, -p);
+    e += a.hi * b.lo + a.lo * b.hi;
+    return ddQuickTwoSum(p, e);
+}
+
+// exact: scaling by a power of two only changes the exponents
+inline DoubleDouble ddTimes2(const DoubleDouble &a) {
+    return DoubleDouble(2. * a.hi, 2. * a.lo);
+}
+
+#endif
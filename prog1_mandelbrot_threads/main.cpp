@@ -1,28 +1,32 @@
 #include <stdio.h>
 #include <algorithm>
 #include <getopt.h>
+#include <vector>
+
+#include <math.h>
+#include <string.h>
 
 #include "CycleTimer.h"
+#include "mandelbrot.h"
+#include "viewportCache.h"
 
-extern void mandelbrotSerial(
-    float x0, float y0, float x1, float y1,
+extern void writePPMImage(
+    int* data,
     int width, int height,
-    int startRow, int numRows,
-    int maxIterations,
-    int output[]);
+    const char *filename,
+    int maxIterations);
 
-extern void mandelbrotThread(
-    int numThreads,
-    float x0, float y0, float x1, float y1,
+extern void writeSmoothPPMImage(
+    float* data,
     int width, int height,
-    int maxIterations,
-    int output[]);
+    const char *filename);
 
-extern void writePPMImage(
+extern void writePNGImage(
     int* data,
     int width, int height,
     const char *filename,
-    int maxIterations);
+    int maxIterations,
+    int numThreads);
 
 void
 scaleAndShift(float& x0, float& x1, float& y0, float& y1,
@@ -46,10 +50,25 @@ void usage(const char* progname) {
     printf("Program Options:\n");
     printf("  -t  --threads <N>  Use N threads\n");
     printf("  -v  --view <INT>   Use specified view settings\n");
+    printf("  -s  --schedule <rows|tiles|cost>  Work distribution among threads\n");
+    printf("      --tile <N>     Use NxN tiles for the tile schedules\n");
+    printf("  -k  --kernel <auto|scalar|avx2|avx512>  Per-pixel kernel used by the threads\n");
+    printf("  -c  --cull         Skip iterating points known to be inside the set\n");
+    printf("  -m  --mariani      Also render with Mariani-Silver subdivision\n");
+    printf("      --smooth       Also render smooth (fractional) escape times, colored\n");
+    printf("  -p  --progressive  Also render coarse to fine, reporting when each pass is ready\n");
+    printf("      --pan <N>      Also render N panning frames and a zoom out/in through a viewport cache\n");
+    printf("      --deep <R>     Only render a deep zoom of radius R with perturbation iteration\n");
+    printf("  -b  --batch <FILE> Only render the frames listed in FILE, one \"x0 y0 x1 y1\" viewport per line\n");
+    printf("      --png          Write batch frames as compressed PNGs instead of PPMs\n");
+    printf("      --poster <W>x<H>  Only render a WxH image in bands, streamed to mandelbrot-poster.pgm\n");
+    printf("      --depth <8|16> Bits per pixel of the poster (16 keeps the iteration counts)\n");
+    printf("  -i  --iters <N>    Use at most N iterations per pixel (default 256)\n");
     printf("  -?  --help         This message\n");
 }
 
-bool verifyResult (int *gold, int *result, int width, int height) {
+template <typename T>
+bool verifyResult (int *gold, T *result, int width, int height) {
 
     int i, j;
 
@@ -57,7 +76,7 @@ bool verifyResult (int *gold, int *result, int width, int height) {
         for (j = 0; j < width; j++) {
             if (gold[i * width + j] != result[i * width + j]) {
                 printf ("Mismatch : [%d][%d], Expected : %d, Actual : %d\n",
-                            i, j, gold[i * width + j], result[i * width + j]);
+                            i, j, gold[i * width + j], (int)result[i * width + j]);
                 return 0;
             }
         }
@@ -66,12 +85,335 @@ bool verifyResult (int *gold, int *result, int width, int height) {
     return 1;
 }
 
+//
+// verifyCullBoundary --
+//
+// The interior tests of the cull kernels are where they can go wrong:
+// a point just outside the main cardioid or the period-2 bulb may take
+// thousands of iterations to escape.  Checks the cull kernel against
+// plain iteration on points on and near both boundaries, and returns the
+// number of points that differ.
+int verifyCullBoundary(MandelKernel kernel, int maxIterations) {
+    const int NUM_ANGLES = 512;
+    // radial offsets, as fractions of the boundary's radius
+    const double offsets[] = { -1e-3, -1e-5, -1e-7, 0., 1e-7, 1e-5 };
+    const int numOffsets = sizeof(offsets) / sizeof(offsets[0]);
+
+    std::vector<float> xs, ys;
+    for (int k = 0; k < NUM_ANGLES; k++) {
+        double t = 2. * M_PI * (k + .5) / NUM_ANGLES;
+        for (int m = 0; m < numOffsets; m++) {
+            // cardioid: c = r e^it / 2 - (r e^it)^2 / 4, with r = 1 on it
+            double r = 1. + offsets[m];
+            xs.push_back((float)(r * cos(t) / 2. - r * r * cos(2. * t) / 4.));
+            ys.push_back((float)(r * sin(t) / 2. - r * r * sin(2. * t) / 4.));
+            // bulb: circle of radius 1/4 around -1
+            xs.push_back((float)(-1. + .25 * r * cos(t)));
+            ys.push_back((float)(.25 * r * sin(t)));
+        }
+    }
+    // the cusp where the cardioid meets the bulb
+    for (int k = 1; k <= 64; k++) {
+        xs.push_back(-.75f);
+        ys.push_back((float)pow(2., -k / 4.));
+    }
+
+    int numPoints = xs.size();
+    std::vector<int> gold(numPoints), result(numPoints);
+    mandelbrotSerialPoints(xs.data(), ys.data(), numPoints, maxIterations, gold.data());
+    getMandelPointsFunc(kernel, true)(xs.data(), ys.data(), numPoints, maxIterations,
+                                      result.data());
+
+    int numDiffer = 0;
+    for (int k = 0; k < numPoints; k++) {
+        if (gold[k] != result[k]) {
+            if (numDiffer == 0)
+                printf ("Mismatch : point (%.9g, %.9g), Expected : %d, Actual : %d\n",
+                        xs[k], ys[k], gold[k], result[k]);
+            numDiffer++;
+        }
+    }
+    return numDiffer;
+}
+
+//
+// runCompactThread --
+//
+// Runs mandelbrotThread() writing T counts instead of int and checks the
+// result against the serial output.  Returns the best time, or a
+// negative value if the output does not match.
+template <typename T>
+double runCompactThread(int numThreads, float x0, float y0, float x1, float y1,
+                        int width, int height, int maxIterations,
+                        const MandelOptions& options, int *gold) {
+    T* output = new T[width*height];
+
+    double minThread = 1e30;
+    for (int i = 0; i < 5; ++i) {
+        memset(output, 0, width * height * sizeof(T));
+        double startTime = CycleTimer::currentSeconds();
+        mandelbrotThread(numThreads, x0, y0, x1, y1, width, height, maxIterations, output,
+                         options);
+        double endTime = CycleTimer::currentSeconds();
+        minThread = std::min(minThread, endTime - startTime);
+    }
+
+    bool ok = verifyResult(gold, output, width, height);
+    delete[] output;
+    return ok ? minThread : -1;
+}
+
+void printThreadStats(const MandelThreadStats& stats) {
+    int n = stats.busySeconds.size();
+    double minBusy = 1e30, maxBusy = 0, sumBusy = 0;
+
+    printf("[thread busy time]:\t\t%d tasks, per thread (ms):", stats.numTasks);
+    for (int i = 0; i < n; i++) {
+        double busy = stats.busySeconds[i];
+        minBusy = std::min(minBusy, busy);
+        maxBusy = std::max(maxBusy, busy);
+        sumBusy += busy;
+        printf("%s%.1f", (i % 8 == 0) ? "\n\t\t\t\t" : " ", busy * 1000);
+    }
+    printf("\n\t\t\t\tmin %.3f / avg %.3f / max %.3f ms (imbalance %.2fx)\n",
+           minBusy * 1000, sumBusy / n * 1000, maxBusy * 1000,
+           sumBusy > 0 ? maxBusy / (sumBusy / n) : 1.0);
+}
+
+void printProgressiveLevel(const int *output, int width, int height,
+                           int level, int numLevels, double seconds, void *userData) {
+    int stride = 1 << (numLevels - 1 - level);
+    double frameSeconds = *(const double *)userData;
+    printf("[progressive pass %d/%d]:\t[%.3f] ms\t(1/%d of pixels sampled, %.2fx a threaded frame)\n",
+           level + 1, numLevels, seconds * 1000, stride * stride, seconds / frameSeconds);
+}
+
+//
+// runDeepZoom --
+//
+// Renders a zoom of the given radius into the seahorse valley with the
+// perturbation renderer, and compares it with direct double precision
+// iteration (which is only trustworthy down to radii around 1e-12) and
+// with direct double-double iteration of a sample of the pixels (down
+// to radii around 1e-20).  Sampled pixels whose double-double count
+// itself changes when the pixel moves by a tiny fraction of its width
+// are chaotic at the limit of the precision, and no renderer can be
+// expected to match them; any other mismatch is reported as a possible
+// glitch.
+int runDeepZoom(int numThreads, double radius, int width, int height,
+                int maxIterations, const MandelOptions& options) {
+    // -0.743643887037158704752191506114774 + 0.131825904205311970493132056385139i
+    const DoubleDouble centerX(-0.7436438870371587, -3.628952515063387e-17);
+    const DoubleDouble centerY(0.13182590420531198, -1.2892807754956675e-17);
+    // every SAMPLE_STEP-th pixel in each direction is checked in double-double
+    const int SAMPLE_STEP = 16;
+    // fraction of a pixel the double-double check is moved by, in each
+    // of four directions, to find chaotic pixels; the series
+    // approximation is within about 1e-10
+    const double SHIFT = 1e-9;
+
+    int* output_direct = new int[width*height];
+    int* output_deep = new int[width*height];
+    int* output_reference = new int[width*height];
+    int* output_shifted = new int[width*height];
+
+    double minDirect = 1e30;
+    for (int i = 0; i < 3; ++i) {
+        double startTime = CycleTimer::currentSeconds();
+        mandelbrotDeepDirect(numThreads, centerX, centerY, radius, width, height,
+                             maxIterations, output_direct);
+        double endTime = CycleTimer::currentSeconds();
+        minDirect = std::min(minDirect, endTime - startTime);
+    }
+
+    printf("[deep zoom double]:\t\t[%.3f] ms\n", minDirect * 1000);
+    writePPMImage(output_direct, width, height, "mandelbrot-deep-double.ppm", maxIterations);
+
+    MandelDeepStats stats;
+    double minDeep = 1e30;
+    for (int i = 0; i < 3; ++i) {
+        double startTime = CycleTimer::currentSeconds();
+        mandelbrotDeep(numThreads, centerX, centerY, radius, width, height,
+                       maxIterations, output_deep, options, &stats);
+        double endTime = CycleTimer::currentSeconds();
+        minDeep = std::min(minDeep, endTime - startTime);
+    }
+
+    printf("[deep zoom perturbation]:\t[%.3f] ms\n", minDeep * 1000);
+    writePPMImage(output_deep, width, height, "mandelbrot-deep.ppm", maxIterations);
+
+    mandelbrotDeepReference(numThreads, centerX, centerY, radius, width, height, SAMPLE_STEP,
+                            maxIterations, output_reference);
+    std::vector<bool> chaotic(width * height, false);
+    const double shifts[4][2] = { {1., 0.}, {-1., 0.}, {0., 1.}, {0., -1.} };
+    double shift = SHIFT * 2. * radius / height;
+    for (int s = 0; s < 4; s++) {
+        mandelbrotDeepReference(numThreads,
+                                centerX + DoubleDouble(shifts[s][0] * shift),
+                                centerY + DoubleDouble(shifts[s][1] * shift),
+                                radius, width, height, SAMPLE_STEP,
+                                maxIterations, output_shifted);
+        for (int j = 0; j < height; j += SAMPLE_STEP)
+            for (int i = 0; i < width; i += SAMPLE_STEP)
+                if (output_shifted[j * width + i] != output_reference[j * width + i])
+                    chaotic[j * width + i] = true;
+    }
+
+    int numDiffer = 0;
+    for (int i = 0; i < width * height; i++)
+        numDiffer += output_direct[i] != output_deep[i];
+
+    std::vector<int> samples;
+    int numSampleDiffer = 0, numChaotic = 0;
+    for (int j = 0; j < height; j += SAMPLE_STEP) {
+        for (int i = 0; i < width; i += SAMPLE_STEP) {
+            int index = j * width + i;
+            samples.push_back(output_reference[index]);
+            if (output_reference[index] != output_deep[index]) {
+                numSampleDiffer++;
+                numChaotic += chaotic[index];
+            }
+        }
+    }
+    int numSampled = samples.size();
+
+    // distinct counts in the sample, to tell a real image from a flat
+    // one (e.g. everything at maxIterations)
+    std::sort(samples.begin(), samples.end());
+    int numSampleLevels = std::unique(samples.begin(), samples.end()) - samples.begin();
+
+    printf("\t\t\t\tradius %g, %d iterations: %d pixels differ from double (%.2f%%)\n",
+           radius, maxIterations, numDiffer, 100. * numDiffer / (width * height));
+    printf("\t\t\t\t%d of %d sampled pixels differ from double-double (%.2f%%), %d distinct counts\n",
+           numSampleDiffer, numSampled, 100. * numSampleDiffer / numSampled, numSampleLevels);
+    printf("\t\t\t\t%d of them chaotic (double-double changes %g pixel away), %d possible glitches\n",
+           numChaotic, SHIFT, numSampleDiffer - numChaotic);
+    printf("\t\t\t\tseries approximation skipped %d of %d reference iterations\n",
+           stats.skipped, stats.referenceLength);
+    printf("\t\t\t\t(%.2fx speedup from perturbation)\n", minDirect/minDeep);
+
+    delete[] output_direct;
+    delete[] output_deep;
+    delete[] output_reference;
+    delete[] output_shifted;
+
+    return 0;
+}
+
+struct BatchOutput {
+    int maxIterations;
+    // write PNGs compressed on numThreads threads instead of PPMs
+    bool png;
+    int numThreads;
+};
+
+void writeBatchFrame(const int *output, int width, int height, int frame, void *userData) {
+    const BatchOutput *out = (const BatchOutput *)userData;
+    char filename[64];
+    snprintf(filename, sizeof(filename), "mandelbrot-frame-%04d.%s", frame, out->png ? "png" : "ppm");
+    if (out->png)
+        writePNGImage(const_cast<int*>(output), width, height, filename, out->maxIterations,
+                      out->numThreads);
+    else
+        writePPMImage(const_cast<int*>(output), width, height, filename, out->maxIterations);
+}
+
+//
+// runBatch --
+//
+// Renders the viewports listed in filename one frame at a time with
+// mandelbrotThread(), as separate invocations would, and then as a
+// single batch that overlaps computing frames with writing them.
+int runBatch(int numThreads, const char *filename, int width, int height,
+             int maxIterations, const MandelOptions& options, bool png) {
+    FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", filename);
+        return 1;
+    }
+
+    std::vector<MandelViewport> views;
+    MandelViewport view;
+    while (fscanf(fp, "%f %f %f %f", &view.x0, &view.y0, &view.x1, &view.y1) == 4)
+        views.push_back(view);
+    if (fp != stdin)
+        fclose(fp);
+
+    if (views.empty()) {
+        fprintf(stderr, "No viewports in %s\n", filename);
+        return 1;
+    }
+    int numFrames = views.size();
+    BatchOutput out = { maxIterations, png, numThreads };
+
+    double startTime = CycleTimer::currentSeconds();
+    int* output = new int[width*height];
+    for (int i = 0; i < numFrames; i++) {
+        mandelbrotThread(numThreads, views[i].x0, views[i].y0, views[i].x1, views[i].y1,
+                         width, height, maxIterations, output, options);
+        writeBatchFrame(output, width, height, i, &out);
+    }
+    delete[] output;
+    double sequential = CycleTimer::currentSeconds() - startTime;
+
+    printf("[frame by frame]:\t\t[%.3f] ms\t(%.2f frames/s)\n",
+           sequential * 1000, numFrames / sequential);
+
+    MandelBatchStats stats;
+    mandelbrotBatch(numThreads, views.data(), numFrames, width, height, maxIterations,
+                    options, writeBatchFrame, &out, &stats);
+
+    printf("[batch]:\t\t\t[%.3f] ms\t(%.2f frames/s)\n",
+           stats.seconds * 1000, numFrames / stats.seconds);
+    printf("\t\t\t\t%d frames, %.3f ms waiting for frames, %.3f ms writing\n",
+           numFrames, stats.waitSeconds * 1000, stats.callbackSeconds * 1000);
+    printf("\t\t\t\t(%.2fx speedup from batching)\n", sequential / stats.seconds);
+
+    return 0;
+}
+
+//
+// runPoster --
+//
+// Renders a poster of arbitrary size without ever holding the whole
+// image in memory.
+int runPoster(int numThreads, float x0, float y0, float x1, float y1,
+              int width, int height, int maxIterations, int bitDepth,
+              const MandelOptions& options) {
+    const int bandHeight = 64;
+
+    MandelPosterStats stats;
+    if (!mandelbrotPoster(numThreads, x0, y0, x1, y1, width, height, maxIterations,
+                          bandHeight, bitDepth, "mandelbrot-poster.pgm", options, &stats))
+        return 1;
+
+    double pixels = (double)width * height;
+    printf("[mandelbrot poster]:\t\t[%.3f] ms\t(%.1f Mpixels/s)\n",
+           stats.seconds * 1000, pixels / stats.seconds / 1e6);
+    printf("\t\t\t\t%dx%d, %d bands, %.1f MB of buffers (%.1f MB as one image)\n",
+           width, height, stats.numBands, stats.bufferBytes / 1e6, pixels * sizeof(int) / 1e6);
+    printf("\t\t\t\t%.3f ms waiting for bands, %.3f ms writing\n",
+           stats.waitSeconds * 1000, stats.writeSeconds * 1000);
+
+    return 0;
+}
+
 int main(int argc, char** argv) {
 
     const unsigned int width = 1600;
     const unsigned int height = 1200;
-    const int maxIterations = 256;
+    int maxIterations = 256;
     int numThreads = 2;
+    MandelOptions options;
+    bool useMariani = false;
+    bool useProgressive = false;
+    bool useSmooth = false;
+    int panFrames = 0;
+    double deepRadius = 0;
+    const char *batchFile = NULL;
+    bool usePNG = false;
+    int posterWidth = 0, posterHeight = 0;
+    int posterDepth = 8;
 
     float x0 = -2;
     float x1 = 1;
@@ -83,11 +425,25 @@ int main(int argc, char** argv) {
     static struct option long_options[] = {
         {"threads", 1, 0, 't'},
         {"view", 1, 0, 'v'},
+        {"schedule", 1, 0, 's'},
+        {"tile", 1, 0, 'T'},
+        {"kernel", 1, 0, 'k'},
+        {"cull", 0, 0, 'c'},
+        {"mariani", 0, 0, 'm'},
+        {"progressive", 0, 0, 'p'},
+        {"smooth", 0, 0, 'S'},
+        {"pan", 1, 0, 'P'},
+        {"deep", 1, 0, 'D'},
+        {"batch", 1, 0, 'b'},
+        {"png", 0, 0, 'N'},
+        {"poster", 1, 0, 'O'},
+        {"depth", 1, 0, 'd'},
+        {"iters", 1, 0, 'i'},
         {"help", 0, 0, '?'},
         {0 ,0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "t:v:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "t:v:s:k:cmpb:i:?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 't':
@@ -110,6 +466,108 @@ int main(int argc, char** argv) {
             }
             break;
         }
+        case 's':
+        {
+            if (strcmp(optarg, "rows") == 0) {
+                options.schedule = SCHEDULE_ROWS;
+            } else if (strcmp(optarg, "tiles") == 0) {
+                options.schedule = SCHEDULE_TILES;
+            } else if (strcmp(optarg, "cost") == 0) {
+                options.schedule = SCHEDULE_COST;
+            } else {
+                fprintf(stderr, "Invalid schedule %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'T':
+        {
+            options.tileWidth = options.tileHeight = atoi(optarg);
+            if (options.tileWidth < 1) {
+                fprintf(stderr, "Invalid tile size\n");
+                return 1;
+            }
+            break;
+        }
+        case 'k':
+        {
+            if (strcmp(optarg, "auto") == 0) {
+                options.kernel = KERNEL_AUTO;
+            } else if (strcmp(optarg, "scalar") == 0) {
+                options.kernel = KERNEL_SCALAR;
+            } else if (strcmp(optarg, "avx2") == 0) {
+                options.kernel = KERNEL_AVX2;
+            } else if (strcmp(optarg, "avx512") == 0) {
+                options.kernel = KERNEL_AVX512;
+            } else {
+                fprintf(stderr, "Invalid kernel %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'c':
+            options.cullInterior = true;
+            break;
+        case 'm':
+            useMariani = true;
+            break;
+        case 'p':
+            useProgressive = true;
+            break;
+        case 'S':
+            useSmooth = true;
+            break;
+        case 'P':
+        {
+            panFrames = atoi(optarg);
+            if (panFrames < 1) {
+                fprintf(stderr, "Invalid number of pan frames\n");
+                return 1;
+            }
+            break;
+        }
+        case 'D':
+        {
+            deepRadius = atof(optarg);
+            if (deepRadius <= 0) {
+                fprintf(stderr, "Invalid deep zoom radius\n");
+                return 1;
+            }
+            break;
+        }
+        case 'b':
+            batchFile = optarg;
+            break;
+        case 'N':
+            usePNG = true;
+            break;
+        case 'O':
+        {
+            if (sscanf(optarg, "%dx%d", &posterWidth, &posterHeight) != 2 ||
+                posterWidth < 1 || posterHeight < 1) {
+                fprintf(stderr, "Invalid poster size %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'd':
+        {
+            posterDepth = atoi(optarg);
+            if (posterDepth != 8 && posterDepth != 16) {
+                fprintf(stderr, "Invalid poster depth\n");
+                return 1;
+            }
+            break;
+        }
+        case 'i':
+        {
+            maxIterations = atoi(optarg);
+            if (maxIterations < 1) {
+                fprintf(stderr, "Invalid iteration count\n");
+                return 1;
+            }
+            break;
+        }
         case '?':
         default:
             usage(argv[0]);
@@ -118,6 +576,14 @@ int main(int argc, char** argv) {
     }
     // end parsing of commandline options
 
+    if (deepRadius > 0)
+        return runDeepZoom(numThreads, deepRadius, width, height, maxIterations, options);
+    if (posterWidth > 0)
+        return runPoster(numThreads, x0, y0, x1, y1, posterWidth, posterHeight,
+                         maxIterations, posterDepth, options);
+    if (batchFile)
+        return runBatch(numThreads, batchFile, width, height, maxIterations, options, usePNG);
+
 
     int* output_serial = new int[width*height];
     int* output_thread = new int[width*height];
@@ -139,20 +605,74 @@ int main(int argc, char** argv) {
     printf("[mandelbrot serial]:\t\t[%.3f] ms\n", minSerial * 1000);
     writePPMImage(output_serial, width, height, "mandelbrot-serial.ppm", maxIterations);
 
+    //
+    // Run the selected kernel on a single thread, if it differs from the
+    // serial reference (vectorized and/or interior culling)
+    //
+
+    options.kernel = resolveMandelKernel(options.kernel);
+    char kernelLabel[32];
+    snprintf(kernelLabel, sizeof(kernelLabel), "%s%s", mandelKernelName(options.kernel),
+             options.cullInterior ? "+cull" : "");
+
+    if (options.kernel != KERNEL_SCALAR || options.cullInterior) {
+        MandelTileFunc tileFunc = getMandelTileFunc(options.kernel, options.cullInterior);
+
+        double minKernel = 1e30;
+        for (int i = 0; i < 5; ++i) {
+            memset(output_thread, 0, width * height * sizeof(int));
+            double startTime = CycleTimer::currentSeconds();
+            tileFunc(x0, y0, x1, y1, width, height, 0, height, 0, width, maxIterations, output_thread);
+            double endTime = CycleTimer::currentSeconds();
+            minKernel = std::min(minKernel, endTime - startTime);
+        }
+
+        printf("[mandelbrot %s]:\t\t[%.3f] ms\n", kernelLabel, minKernel * 1000);
+
+        if (! verifyResult (output_serial, output_thread, width, height)) {
+            printf ("Error : Output from %s kernel does not match serial output\n", kernelLabel);
+
+            delete[] output_serial;
+            delete[] output_thread;
+
+            return 1;
+        }
+        printf("\t\t\t\t(%.2fx speedup from %s)\n", minSerial/minKernel, kernelLabel);
+
+        if (options.cullInterior) {
+            int numDiffer = verifyCullBoundary(options.kernel, maxIterations);
+            if (numDiffer > 0) {
+                printf ("Error : %s kernel differs from plain iteration on %d points near the cardioid and bulb\n",
+                        kernelLabel, numDiffer);
+
+                delete[] output_serial;
+                delete[] output_thread;
+
+                return 1;
+            }
+        }
+    }
+
     //
     // Run the threaded version
     //
 
     double minThread = 1e30;
+    MandelThreadStats threadStats, minThreadStats;
     for (int i = 0; i < 5; ++i) {
       memset(output_thread, 0, width * height * sizeof(int));
         double startTime = CycleTimer::currentSeconds();
-        mandelbrotThread(numThreads, x0, y0, x1, y1, width, height, maxIterations, output_thread);
+        mandelbrotThread(numThreads, x0, y0, x1, y1, width, height, maxIterations, output_thread,
+                         options, &threadStats);
         double endTime = CycleTimer::currentSeconds();
-        minThread = std::min(minThread, endTime - startTime);
+        if (endTime - startTime < minThread) {
+            minThread = endTime - startTime;
+            minThreadStats = threadStats;
+        }
     }
 
     printf("[mandelbrot thread]:\t\t[%.3f] ms\n", minThread * 1000);
+    printThreadStats(minThreadStats);
     writePPMImage(output_thread, width, height, "mandelbrot-thread.ppm", maxIterations);
 
     if (! verifyResult (output_serial, output_thread, width, height)) {
@@ -167,6 +687,210 @@ int main(int argc, char** argv) {
     // compute speedup
     printf("\t\t\t\t(%.2fx speedup from %d threads)\n", minSerial/minThread, numThreads);
 
+    //
+    // Run the threaded version again with the narrowest count type that
+    // holds maxIterations, to show the saving in output traffic
+    //
+
+    MandelOutputFormat format = mandelOutputFormat(maxIterations);
+    if (format != OUTPUT_INT) {
+        const char *formatName = format == OUTPUT_UINT8 ? "uint8" : "uint16";
+        double minCompact = format == OUTPUT_UINT8 ?
+            runCompactThread<uint8_t>(numThreads, x0, y0, x1, y1, width, height,
+                                      maxIterations, options, output_serial) :
+            runCompactThread<uint16_t>(numThreads, x0, y0, x1, y1, width, height,
+                                       maxIterations, options, output_serial);
+
+        if (minCompact < 0) {
+            printf ("Error : %s output from threads does not match serial output\n", formatName);
+
+            delete[] output_serial;
+            delete[] output_thread;
+
+            return 1;
+        }
+
+        printf("[mandelbrot thread %s]:\t[%.3f] ms\n", formatName, minCompact * 1000);
+        printf("\t\t\t\t(%.2fx speedup from %s output)\n", minThread/minCompact, formatName);
+    }
+
+    //
+    // Run the smooth coloring renderer, and check its polynomial log2
+    // against libm
+    //
+
+    if (useSmooth) {
+        float* output_smooth = new float[width*height];
+        float* output_reference = new float[width*height];
+
+        double minSmooth = 1e30;
+        for (int i = 0; i < 5; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrotSmooth(numThreads, x0, y0, x1, y1, width, height, maxIterations,
+                             output_smooth, options);
+            double endTime = CycleTimer::currentSeconds();
+            minSmooth = std::min(minSmooth, endTime - startTime);
+        }
+
+        printf("[mandelbrot smooth]:\t\t[%.3f] ms\n", minSmooth * 1000);
+        writeSmoothPPMImage(output_smooth, width, height, "mandelbrot-smooth.ppm");
+
+        mandelbrotSmoothReference(x0, y0, x1, y1, width, height, maxIterations, output_reference);
+        double maxError = 0;
+        for (unsigned int i = 0; i < width * height; i++)
+            maxError = std::max(maxError, (double)fabsf(output_smooth[i] - output_reference[i]));
+        printf("\t\t\t\tmax error %.2e iterations against libm log2\n",
+               maxError * maxIterations);
+        printf("\t\t\t\t(%.2fx the time of integer counts)\n", minSmooth/minThread);
+
+        delete[] output_smooth;
+        delete[] output_reference;
+
+        if (maxError * maxIterations > 1e-3) {
+            printf ("Error : Smooth output differs from the reference\n");
+
+            delete[] output_serial;
+            delete[] output_thread;
+
+            return 1;
+        }
+    }
+
+    //
+    // Run the Mariani-Silver renderer.  It fills uniform regions without
+    // iterating them, so its output is approximate and may differ from
+    // the serial output in a few pixels; report how many instead of
+    // failing, and compare its time with the threaded renderer's.
+    //
+
+    if (useMariani) {
+        double minMariani = 1e30;
+        MandelFillStats fillStats;
+        for (int i = 0; i < 5; ++i) {
+            memset(output_thread, 0, width * height * sizeof(int));
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrotMariani(numThreads, x0, y0, x1, y1, width, height, maxIterations, output_thread,
+                              options, &fillStats);
+            double endTime = CycleTimer::currentSeconds();
+            minMariani = std::min(minMariani, endTime - startTime);
+        }
+
+        printf("[mandelbrot mariani-silver]:\t[%.3f] ms\n", minMariani * 1000);
+        writePPMImage(output_thread, width, height, "mandelbrot-mariani.ppm", maxIterations);
+
+        int numDiffer = 0;
+        for (unsigned int i = 0; i < width * height; i++)
+            numDiffer += output_serial[i] != output_thread[i];
+
+        long long numPixels = (long long)width * height;
+        printf("\t\t\t\t%lld pixels iterated (%.1f%%), %lld filled (%.1f%%), %d differ from serial\n",
+               fillStats.numIterated, 100. * fillStats.numIterated / numPixels,
+               fillStats.numFilled, 100. * fillStats.numFilled / numPixels, numDiffer);
+        printf("\t\t\t\t(%.2fx speedup from mariani-silver over %d threads)\n",
+               minThread/minMariani, numThreads);
+    }
+
+    //
+    // Run the progressive renderer once: what matters is how soon each
+    // pass is available, not the best-of-five total
+    //
+
+    if (useProgressive) {
+        memset(output_thread, 0, width * height * sizeof(int));
+        double startTime = CycleTimer::currentSeconds();
+        mandelbrotProgressive(numThreads, x0, y0, x1, y1, width, height, maxIterations, output_thread,
+                              options, printProgressiveLevel, &minThread);
+        double endTime = CycleTimer::currentSeconds();
+        printf("\t\t\t\t(%.0f%% overhead over a threaded frame for the coarse passes)\n",
+               100. * ((endTime - startTime) / minThread - 1.));
+        writePPMImage(output_thread, width, height, "mandelbrot-progressive.ppm", maxIterations);
+
+        if (! verifyResult (output_serial, output_thread, width, height)) {
+            printf ("Error : Progressive output does not match serial output\n");
+
+            delete[] output_serial;
+            delete[] output_thread;
+
+            return 1;
+        }
+    }
+
+    //
+    // Render a camera path through the viewport cache: panFrames frames
+    // panning by (7, 3) pixels, then a 2x zoom out and back in.  Every
+    // frame is also rendered from scratch, which must give the same
+    // pixels, and by mandelbrotThread() to measure the savings.
+    //
+
+    if (panFrames > 0) {
+        ViewportCache cache(width, height, maxIterations);
+        ViewportCache uncached(width, height, maxIterations);
+        int *output_uncached = new int[width*height];
+
+        double viewX0 = x0, viewY0 = y0;
+        double dx = (x1 - x0) / width;
+        double dy = (y1 - y0) / height;
+        double cachedTime = 0, uncachedTime = 0, threadTime = 0;
+        int numDiffer = 0;
+
+        for (int f = 0; f < panFrames + 2; f++) {
+            if (f == panFrames) {
+                viewX0 -= width / 2 * dx;
+                viewY0 -= height / 2 * dy;
+                dx *= 2;
+                dy *= 2;
+            } else if (f == panFrames + 1) {
+                dx /= 2;
+                dy /= 2;
+                viewX0 += width / 2 * dx;
+                viewY0 += height / 2 * dy;
+            } else if (f > 0) {
+                viewX0 += 7 * dx;
+                viewY0 += 3 * dy;
+            }
+
+            double startTime = CycleTimer::currentSeconds();
+            cache.render(numThreads, viewX0, viewY0, dx, dy, options, output_thread);
+            double midTime = CycleTimer::currentSeconds();
+            uncached.invalidate();
+            uncached.render(numThreads, viewX0, viewY0, dx, dy, options, output_uncached);
+            double endTime = CycleTimer::currentSeconds();
+
+            cachedTime += midTime - startTime;
+            uncachedTime += endTime - midTime;
+            for (unsigned int i = 0; i < width * height; i++)
+                numDiffer += output_thread[i] != output_uncached[i];
+
+            startTime = CycleTimer::currentSeconds();
+            mandelbrotThread(numThreads, (float)viewX0, (float)viewY0,
+                             (float)(viewX0 + width * dx), (float)(viewY0 + height * dy),
+                             width, height, maxIterations, output_uncached, options);
+            threadTime += CycleTimer::currentSeconds() - startTime;
+        }
+
+        const ViewportCacheStats &cacheStats = cache.getStats();
+        long long numSamples = cacheStats.pixelsReused + cacheStats.pixelsComputed;
+        printf("[viewport cache]:\t\t[%.3f] ms for %d frames (threaded [%.3f] ms, uncached [%.3f] ms)\n",
+               cachedTime * 1000, cacheStats.frames, threadTime * 1000, uncachedTime * 1000);
+        printf("\t\t\t\t%lld pixel hits (%.1f%%), %lld misses, %d/%d frames reused pixels\n",
+               cacheStats.pixelsReused, 100. * cacheStats.pixelsReused / numSamples,
+               cacheStats.pixelsComputed, cacheStats.framesReused, cacheStats.frames);
+        printf("\t\t\t\t(%.2fx speedup from viewport cache over %d threads)\n",
+               threadTime / cachedTime, numThreads);
+
+        if (numDiffer > 0) {
+            printf ("Error : %d cached pixels differ from an uncached render\n", numDiffer);
+
+            delete[] output_uncached;
+            delete[] output_serial;
+            delete[] output_thread;
+
+            return 1;
+        }
+
+        delete[] output_uncached;
+    }
+
     delete[] output_serial;
     delete[] output_thread;
 
@@ -0,0 +1,276 @@
+#ifndef MANDELBROT_H_
+#define MANDELBROT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "doubleDouble.h"
+
+// How mandelbrotThread() divides the image among threads.
+enum MandelSchedule {
+    // One pool task per row, balanced by work stealing.
+    SCHEDULE_ROWS,
+    // 2D tiles handed out in raster order through an atomic counter.
+    SCHEDULE_TILES,
+    // Like SCHEDULE_TILES, but tiles are handed out in decreasing order
+    // of the cost predicted by a low resolution pre-pass.
+    SCHEDULE_COST,
+};
+
+// Which implementation of the per-pixel loop to run.
+enum MandelKernel {
+    // Widest vector kernel supported by the CPU, chosen through CPUID.
+    KERNEL_AUTO,
+    KERNEL_SCALAR,
+    // 8 pixels per instruction
+    KERNEL_AVX2,
+    // 16 pixels per instruction
+    KERNEL_AVX512,
+};
+
+// Element type of an iteration count buffer.  The kernels can write
+// uint8_t or uint16_t counts instead of int to cut memory traffic.
+enum MandelOutputFormat {
+    OUTPUT_UINT8,
+    OUTPUT_UINT16,
+    OUTPUT_INT,
+};
+
+// Smallest format that holds every count from 0 to maxIterations.
+inline MandelOutputFormat mandelOutputFormat(int maxIterations) {
+    return maxIterations <= UINT8_MAX ? OUTPUT_UINT8 :
+           maxIterations <= UINT16_MAX ? OUTPUT_UINT16 : OUTPUT_INT;
+}
+
+// How far inside the main cardioid and the period-2 bulb (in terms of
+// their implicit equations) a point must be for cullInterior to skip it
+// without iterating.  Closer to the boundary, float orbits of points
+// inside can still escape, so they are iterated like any other.
+const double CULL_MARGIN = 1e-6;
+
+struct MandelOptions {
+    MandelSchedule schedule;
+    int tileWidth, tileHeight;
+    MandelKernel kernel;
+    // Skip the iterations of points known to be inside the set (main
+    // cardioid, period-2 bulb, periodic orbits).  Output is unchanged:
+    // points within CULL_MARGIN of the boundaries are still iterated,
+    // and -c checks points along them against plain iteration.
+    bool cullInterior;
+
+    MandelOptions()
+        : schedule(SCHEDULE_ROWS), tileWidth(32), tileHeight(32),
+          kernel(KERNEL_AUTO), cullInterior(false) {}
+};
+
+// Filled in by mandelbrotThread() when a stats object is passed.
+struct MandelThreadStats {
+    // Seconds each thread spent computing pixels (excludes time spent
+    // waiting for or stealing work).
+    std::vector<double> busySeconds;
+    int numTasks;
+};
+
+// Filled in by mandelbrotMariani() when a stats object is passed.
+struct MandelFillStats {
+    long long numIterated;  // pixels run through the kernel
+    long long numFilled;    // pixels copied from a uniform border
+};
+
+// Filled in by mandelbrotDeep() when a stats object is passed.
+struct MandelDeepStats {
+    int referenceLength;    // iteration count of the reference orbit
+    int skipped;            // iterations every pixel skipped by the series
+};
+
+// Called by mandelbrotProgressive() after each pass with the image so
+// far and the time since the render started.
+typedef void (*MandelLevelCallback)(const int *output, int width, int height,
+                                    int level, int numLevels, double seconds,
+                                    void *userData);
+
+// One frame of mandelbrotBatch().
+struct MandelViewport {
+    float x0, y0, x1, y1;
+};
+
+// Called by mandelbrotBatch() with each finished frame, in order.
+typedef void (*MandelFrameCallback)(const int *output, int width, int height,
+                                    int frame, void *userData);
+
+// Filled in by mandelbrotBatch() when a stats object is passed.
+struct MandelBatchStats {
+    int numFrames;
+    double seconds;          // whole batch, first launch to last callback
+    double waitSeconds;      // caller waiting for (and helping with) frames
+    double callbackSeconds;  // caller inside the frame callback
+};
+
+// Filled in by mandelbrotPoster() when a stats object is passed.
+struct MandelPosterStats {
+    int numBands;
+    size_t bufferBytes;     // iteration count buffers, independent of height
+    double seconds;
+    double waitSeconds;     // caller waiting for (and helping with) bands
+    double writeSeconds;    // caller quantizing and writing bands
+};
+
+class ThreadPool;
+
+// The functions templated on the output type T are instantiated for
+// int, uint16_t and uint8_t.  Counts are stored unchecked, so T must be
+// able to hold maxIterations (see mandelOutputFormat()).
+template <typename T>
+void mandelbrotSerial(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int maxIterations,
+    T output[]);
+
+template <typename T>
+void mandelbrotSerialTile(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[]);
+
+template <typename T>
+void mandelbrotSerialTileCull(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[]);
+
+void mandelbrotSerialPoints(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[]);
+
+void mandelbrotSerialPointsCull(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[]);
+
+// Signature shared by mandelbrotSerialTile() and its vectorized
+// variants in mandelbrotSIMD.cpp.
+template <typename T>
+using MandelTileFuncT = void (*)(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[]);
+
+typedef MandelTileFuncT<int> MandelTileFunc;
+
+// Signature of the point-list kernels, for pixels that do not form a
+// tile: output[k] receives the count of the point (xs[k], ys[k]).  To
+// match the tile kernels exactly, pixel (i, j) must be passed as
+// (x0 + i * dx, y0 + j * dy), with dx = (x1 - x0) / width and
+// dy = (y1 - y0) / height, all in float.
+typedef void (*MandelPointsFunc)(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[]);
+
+MandelKernel resolveMandelKernel(MandelKernel kernel);
+const char *mandelKernelName(MandelKernel kernel);
+template <typename T>
+MandelTileFuncT<T> getMandelTileFuncT(MandelKernel kernel, bool cullInterior);
+MandelTileFunc getMandelTileFunc(MandelKernel kernel, bool cullInterior);
+MandelPointsFunc getMandelPointsFunc(MandelKernel kernel, bool cullInterior);
+
+ThreadPool *getThreadPool(int numThreads);
+
+template <typename T>
+void mandelbrotThread(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    T output[],
+    const MandelOptions &options = MandelOptions(),
+    MandelThreadStats *stats = NULL);
+
+void mandelbrotMariani(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    int output[],
+    const MandelOptions &options = MandelOptions(),
+    MandelFillStats *stats = NULL);
+
+void mandelbrotProgressive(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    int output[],
+    const MandelOptions &options,
+    MandelLevelCallback callback, void *userData);
+
+void mandelbrotDeep(
+    int numThreads,
+    DoubleDouble centerX, DoubleDouble centerY, double radius,
+    int width, int height,
+    int maxIterations,
+    int output[],
+    const MandelOptions &options = MandelOptions(),
+    MandelDeepStats *stats = NULL);
+
+void mandelbrotDeepDirect(
+    int numThreads,
+    DoubleDouble centerX, DoubleDouble centerY, double radius,
+    int width, int height,
+    int maxIterations,
+    int output[]);
+
+void mandelbrotDeepReference(
+    int numThreads,
+    DoubleDouble centerX, DoubleDouble centerY, double radius,
+    int width, int height, int step,
+    int maxIterations,
+    int output[]);
+
+void mandelbrotBatch(
+    int numThreads,
+    const MandelViewport *views, int numFrames,
+    int width, int height,
+    int maxIterations,
+    const MandelOptions &options,
+    MandelFrameCallback callback, void *userData,
+    MandelBatchStats *stats = NULL);
+
+bool mandelbrotPoster(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    int bandHeight, int bitDepth,
+    const char *filename,
+    const MandelOptions &options = MandelOptions(),
+    MandelPosterStats *stats = NULL);
+
+void mandelbrotSmooth(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    float output[],
+    const MandelOptions &options = MandelOptions());
+
+void mandelbrotSmoothReference(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    float output[]);
+
+#endif
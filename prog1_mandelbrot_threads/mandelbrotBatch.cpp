@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "mandelbrot.h"
+#include "threadPool.h"
+
+/*
+  Batch rendering of a sequence of viewports (e.g. a zoom animation).
+
+  Every frame is split into tiles that are launched on the shared thread
+  pool as one batch.  Up to FRAMES_IN_FLIGHT frames are launched ahead,
+  each into its own output buffer, so idle workers move on to the tiles
+  of the next frame instead of waiting for the last tiles of the current
+  one.  While the calling thread hands a finished frame to the callback
+  (typically to encode and write it), the workers keep computing the
+  frames behind it.
+ */
+
+static const int FRAMES_IN_FLIGHT = 3;
+
+typedef struct {
+    MandelViewport view;
+    int width;
+    int height;
+    int maxIterations;
+    int* output;
+    MandelTileFunc tileFunc;
+
+    int tileWidth, tileHeight;
+    int tilesX;
+} FrameArgs;
+
+
+//
+// frameTileTask --
+//
+// Pool task entrypoint: computes one tile of one frame, tiles numbered
+// in raster order.
+static void frameTileTask(void *data, int threadIndex, int threadCount,
+                          int taskIndex, int taskCount) {
+    const FrameArgs * const args = (const FrameArgs *)data;
+
+    int startRow = (taskIndex / args->tilesX) * args->tileHeight;
+    int startCol = (taskIndex % args->tilesX) * args->tileWidth;
+    int numRows = std::min(args->tileHeight, args->height - startRow);
+    int numCols = std::min(args->tileWidth, args->width - startCol);
+
+    args->tileFunc(args->view.x0, args->view.y0, args->view.x1, args->view.y1,
+                   args->width, args->height,
+                   startRow, numRows, startCol, numCols,
+                   args->maxIterations, args->output);
+}
+
+//
+// MandelbrotBatch --
+//
+// Renders numFrames viewports on the thread pool and calls callback with
+// each finished frame, in order, on the calling thread.  The output
+// buffer passed to the callback is reused once it returns.  The kernel
+// and tile size are taken from options (the schedule is ignored: frames
+// are always tiled).  If stats is non-NULL it receives the timing of the
+// whole batch.
+void mandelbrotBatch(
+    int numThreads,
+    const MandelViewport *views, int numFrames,
+    int width, int height,
+    int maxIterations,
+    const MandelOptions &options,
+    MandelFrameCallback callback, void *userData,
+    MandelBatchStats *stats)
+{
+    ThreadPool *pool = getThreadPool(numThreads);
+    MandelTileFunc tileFunc = getMandelTileFunc(options.kernel, options.cullInterior);
+
+    int numBuffers = std::min(FRAMES_IN_FLIGHT, numFrames);
+    std::vector<int> buffers((size_t)numBuffers * width * height);
+    std::vector<FrameArgs> args(numBuffers);
+    std::vector<PoolBatch> batches(numBuffers);
+
+    int tilesX = (width + options.tileWidth - 1) / options.tileWidth;
+    int numTiles = tilesX * ((height + options.tileHeight - 1) / options.tileHeight);
+
+    double waitSeconds = 0, callbackSeconds = 0;
+    double startTime = CycleTimer::currentSeconds();
+
+    for (int frame = 0; frame < numFrames + numBuffers - 1; frame++) {
+        // Launch frame, reusing the buffer of the frame written
+        // FRAMES_IN_FLIGHT frames ago...
+        if (frame < numFrames) {
+            int b = frame % numBuffers;
+            FrameArgs &a = args[b];
+            a.view = views[frame];
+            a.width = width;
+            a.height = height;
+            a.maxIterations = maxIterations;
+            a.output = &buffers[(size_t)b * width * height];
+            a.tileFunc = tileFunc;
+            a.tileWidth = options.tileWidth;
+            a.tileHeight = options.tileHeight;
+            a.tilesX = tilesX;
+            pool->launch(frameTileTask, &a, numTiles, &batches[b]);
+        }
+
+        // ...then wait for the oldest frame in flight and hand it out.
+        int done = frame - (numBuffers - 1);
+        if (done < 0)
+            continue;
+
+        int b = done % numBuffers;
+        double syncStart = CycleTimer::currentSeconds();
+        pool->sync(&batches[b]);
+        double syncEnd = CycleTimer::currentSeconds();
+        if (callback)
+            callback(args[b].output, width, height, done, userData);
+        waitSeconds += syncEnd - syncStart;
+        callbackSeconds += CycleTimer::currentSeconds() - syncEnd;
+    }
+
+    if (stats) {
+        stats->numFrames = numFrames;
+        stats->seconds = CycleTimer::currentSeconds() - startTime;
+        stats->waitSeconds = waitSeconds;
+        stats->callbackSeconds = callbackSeconds;
+    }
+}
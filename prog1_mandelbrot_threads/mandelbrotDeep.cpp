@@ -0,0 +1,614 @@
+#include <immintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "doubleDouble.h"
+#include "mandelbrot.h"
+#include "threadPool.h"
+
+/*
+  Deep zoom rendering with perturbation theory.
+
+  Float (and even double) pixel coordinates run out of precision long
+  before interesting zoom depths, because neighbouring pixels differ by
+  less than one ulp of their coordinates.  Instead, one reference orbit
+  Z_n is computed at the view center C in double-double precision (see
+  doubleDouble.h), and every pixel c = C + dc is iterated as a small
+  difference from it:
+
+      z_n = Z_n + d_n,   d_{n+1} = (2 Z_n + d_n) d_n + dc
+
+  d_n is small, so double precision is plenty.  When |z_n| gets smaller
+  than |d_n| (or the reference orbit ends), the pixel is "rebased": the
+  reference index restarts at Z_0 = 0 with d = z_n.  This avoids the
+  glitches of plain perturbation without needing extra reference orbits:
+  the usual glitch test, |z_n| much smaller than |Z_n|, implies
+  |z_n| < |d_n|, so such pixels have already been rebased.
+
+  The reference orbit is stored with a leading Z_0 = 0 so that rebasing
+  is just resetting the index; pixels start at index 1 (Z_1 = C), which
+  matches mandel() starting from z = c.  A series approximation
+  (seriesApproximation()) then moves the start of every pixel as far
+  along the reference as it stays accurate, which at deep zooms skips
+  most of the iterations.
+
+  Speed, one core, 1600x1200, against direct double iteration of the
+  same view (--deep):
+
+      radius 1e-6,  2000 iterations:   1.7x (AVX-512), 0.87x (AVX2)
+      radius 1e-10, 10000 iterations:  5.3x, 896 iterations skipped
+      radius 1e-14, 10000 iterations:  2.2x, 997 skipped
+      radius 1e-20, 20000 iterations:  8.1x (AVX-512), 4.3x (AVX2),
+                                       8006 skipped
+
+  The vector loops only pay off while neighbouring pixels have similar
+  counts, and the series only skips iterations that all pixels share,
+  so shallow, busy views gain least.
+
+  Zoom depth is limited by the 106-bit reference orbit and center.
+  Against direct double-double iteration of the same pixels, a few
+  tenths of a percent of counts differ down to view radii of about
+  1e-20, all of them at pixels whose double-double count itself changes
+  when the pixel moves by 1e-9 of its width; past that the direct
+  iteration loses the pixels, so nothing deeper is checked, and below
+  about 1e-30 the center can no longer be placed between pixels at all.
+  Deltas stay in double, whose exponent range is not a limit at these
+  depths.
+ */
+
+// terms of the series approximation
+const int SERIES_TERMS = 6;
+
+typedef struct {
+    int width, height;
+    int maxIterations;
+    int* output;
+    double dx, dy;
+
+    // reference orbit, refLength entries
+    const double *refRe, *refIm;
+    int refLength;
+
+    // Pixels start at reference index skip, with the delta given by the
+    // series sum(series[k] dc^(k+1)) (see seriesApproximation()).
+    int skip;
+    double seriesRe[SERIES_TERMS], seriesIm[SERIES_TERMS];
+
+    DoubleDouble centerX, centerY;
+    // mandelbrotDeepReference() computes every step-th row and column
+    int step;
+} DeepArgs;
+
+
+//
+// computeReferenceOrbit --
+//
+// Iterates the view center in double-double until it escapes or
+// reaches maxIterations, storing Z_0 = 0, Z_1 = C, Z_2, ... as doubles.
+static void computeReferenceOrbit(DoubleDouble cx, DoubleDouble cy, int maxIterations,
+                                  std::vector<double> &refRe, std::vector<double> &refIm) {
+    refRe.assign(1, 0.);
+    refIm.assign(1, 0.);
+
+    DoubleDouble z_re = cx, z_im = cy;
+    for (int i = 0; i <= maxIterations; ++i) {
+        double re = z_re.toDouble(), im = z_im.toDouble();
+        refRe.push_back(re);
+        refIm.push_back(im);
+
+        if (re * re + im * im > 4.)
+            break;
+
+        DoubleDouble new_re = z_re*z_re - z_im*z_im;
+        DoubleDouble new_im = ddTimes2(z_re * z_im);
+        z_re = cx + new_re;
+        z_im = cy + new_im;
+    }
+}
+
+//
+// seriesApproximation --
+//
+// Finds the furthest reference index args->skip that every pixel can
+// start at, and the coefficients of the polynomial in dc that gives the
+// pixel's delta there:
+//
+//     d_n = sum_k A_{n,k} dc^k,   A_{1,1} = 1, A_{1,k} = 0 for k > 1
+//     A_{n+1,k} = 2 Z_n A_{n,k} + sum_{i+j=k} A_{n,i} A_{n,j}  (+1 for k = 1)
+//
+// Near the reference all pixels follow it for most of its orbit, so the
+// skip is most of the work at deep zooms.  The series is trusted up to n
+// only while no pixel can escape or rebase before n (bounding |d_n| by
+// the coefficients at the view corners), and while it matches, to
+// SERIES_TOLERANCE, the deltas of probe pixels at the corners and edge
+// midpoints that are iterated step by step alongside it.  That bound
+// keeps |A_{n,k}| below radius^-k, inside the range of double down to
+// the deepest radii the reference orbit supports.
+static void seriesApproximation(DeepArgs *args) {
+    // relative error of the probe deltas, about 1e-10 of a pixel
+    const double SERIES_TOLERANCE = 1e-12;
+    const int NUM_PROBES = 8;
+
+    const double *refRe = args->refRe, *refIm = args->refIm;
+    int last = args->refLength - 1;
+
+    double xs[3] = { -(args->width / 2) * args->dx, 0.,
+                     (args->width - 1 - args->width / 2) * args->dx };
+    double ys[3] = { -(args->height / 2) * args->dy, 0.,
+                     (args->height - 1 - args->height / 2) * args->dy };
+    double dcRe[NUM_PROBES], dcIm[NUM_PROBES], dRe[NUM_PROBES], dIm[NUM_PROBES];
+    double radius = 0.;
+    int numProbes = 0;
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            if (a == 1 && b == 1)
+                continue;
+            dcRe[numProbes] = dRe[numProbes] = xs[a];
+            dcIm[numProbes] = dIm[numProbes] = ys[b];
+            radius = fmax(radius, hypot(xs[a], ys[b]));
+            numProbes++;
+        }
+    }
+
+    // A[k] is the coefficient of dc^(k+1)
+    double A_re[SERIES_TERMS], A_im[SERIES_TERMS];
+    for (int k = 0; k < SERIES_TERMS; k++)
+        A_re[k] = A_im[k] = 0.;
+    A_re[0] = 1.;
+
+    args->skip = 1;
+    memcpy(args->seriesRe, A_re, sizeof(A_re));
+    memcpy(args->seriesIm, A_im, sizeof(A_im));
+
+    for (int n = 1; n + 1 < last && n + 1 < args->maxIterations; ++n) {
+        double Z_re = refRe[n], Z_im = refIm[n];
+
+        // no pixel may escape or rebase at n, with a factor of two to
+        // spare for the error of the series
+        double Z_abs = hypot(Z_re, Z_im);
+        double dMax = 0., radiusPower = 1.;
+        for (int k = 0; k < SERIES_TERMS; k++) {
+            radiusPower *= radius;
+            dMax += hypot(A_re[k], A_im[k]) * radiusPower;
+        }
+        if (Z_abs + 2. * dMax > 2. || Z_abs < 4. * dMax)
+            break;
+
+        // highest terms first, as they read the lower ones
+        for (int k = SERIES_TERMS - 1; k >= 0; k--) {
+            double new_re = 2. * (Z_re * A_re[k] - Z_im * A_im[k]);
+            double new_im = 2. * (Z_re * A_im[k] + Z_im * A_re[k]);
+            for (int i = 0; i < k; i++) {
+                new_re += A_re[i] * A_re[k - 1 - i] - A_im[i] * A_im[k - 1 - i];
+                new_im += A_re[i] * A_im[k - 1 - i] + A_im[i] * A_re[k - 1 - i];
+            }
+            A_re[k] = new_re;
+            A_im[k] = new_im;
+        }
+        A_re[0] += 1.;
+
+        bool accurate = true;
+        for (int p = 0; p < numProbes; p++) {
+            double a_re = 2. * Z_re + dRe[p];
+            double a_im = 2. * Z_im + dIm[p];
+            double new_re = a_re * dRe[p] - a_im * dIm[p] + dcRe[p];
+            double new_im = a_re * dIm[p] + a_im * dRe[p] + dcIm[p];
+            dRe[p] = new_re;
+            dIm[p] = new_im;
+
+            double s_re = 0., s_im = 0.;
+            for (int k = SERIES_TERMS - 1; k >= 0; k--) {
+                double t_re = s_re + A_re[k], t_im = s_im + A_im[k];
+                s_re = t_re * dcRe[p] - t_im * dcIm[p];
+                s_im = t_re * dcIm[p] + t_im * dcRe[p];
+            }
+            double err = hypot(s_re - dRe[p], s_im - dIm[p]);
+            if (!(err <= SERIES_TOLERANCE * hypot(dRe[p], dIm[p])))
+                accurate = false;
+        }
+        if (!accurate)
+            break;
+
+        args->skip = n + 1;
+        memcpy(args->seriesRe, A_re, sizeof(A_re));
+        memcpy(args->seriesIm, A_im, sizeof(A_im));
+    }
+}
+
+//
+// deepPixel --
+//
+// Iteration count of the pixel at offset (dc_re, dc_im) from the
+// reference orbit.
+static inline int deepPixel(const DeepArgs *args, double dc_re, double dc_im) {
+    const double *refRe = args->refRe, *refIm = args->refIm;
+    int last = args->refLength - 1;
+
+    // the series, as in seriesApproximation(); exactly dc when skip is 1
+    double d_re = 0., d_im = 0.;
+    for (int k = SERIES_TERMS - 1; k >= 0; k--) {
+        double t_re = d_re + args->seriesRe[k], t_im = d_im + args->seriesIm[k];
+        d_re = t_re * dc_re - t_im * dc_im;
+        d_im = t_re * dc_im + t_im * dc_re;
+    }
+    int m = args->skip;
+    int i;
+    for (i = args->skip - 1; i < args->maxIterations; ++i) {
+        double z_re = refRe[m] + d_re;
+        double z_im = refIm[m] + d_im;
+        double mag = z_re * z_re + z_im * z_im;
+
+        if (mag > 4.)
+            break;
+
+        // rebase onto Z_0 = 0
+        if (mag < d_re * d_re + d_im * d_im || m == last) {
+            d_re = z_re;
+            d_im = z_im;
+            m = 0;
+        }
+
+        double a_re = 2. * refRe[m] + d_re;
+        double a_im = 2. * refIm[m] + d_im;
+        double new_re = a_re * d_re - a_im * d_im + dc_re;
+        double new_im = a_re * d_im + a_im * d_re + dc_im;
+        d_re = new_re;
+        d_im = new_im;
+        m++;
+    }
+
+    return i;
+}
+
+static void deepRowTask(void *data, int threadIndex, int threadCount,
+                        int taskIndex, int taskCount) {
+    const DeepArgs * const args = (const DeepArgs *)data;
+
+    int j = taskIndex;
+    double dc_im = (j - args->height / 2) * args->dy;
+    for (int i = 0; i < args->width; i++) {
+        double dc_re = (i - args->width / 2) * args->dx;
+        args->output[j * args->width + i] = deepPixel(args, dc_re, dc_im);
+    }
+}
+
+//
+// deepRowTaskAVX2 --
+//
+// deepPixel() for 4 pixels at a time.  Each lane has its own reference
+// index, so the orbit values are gathered.
+__attribute__((target("avx2")))
+static void deepRowTaskAVX2(void *data, int threadIndex, int threadCount,
+                            int taskIndex, int taskCount) {
+    const DeepArgs * const args = (const DeepArgs *)data;
+
+    // 256 / sizeof(double) == 4
+    const int VECTOR_WIDTH = 4;
+
+    const double *refRe = args->refRe, *refIm = args->refIm;
+    const __m128i last = _mm_set1_epi32(args->refLength - 1);
+    const __m256d four = _mm256_set1_pd(4.);
+    const __m256d two = _mm256_set1_pd(2.);
+    const __m256d one = _mm256_set1_pd(1.);
+    const __m256d allLanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    // picks the low 32 bits of each 64-bit lane mask
+    const __m256i packMask = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+    int width = args->width;
+    int j = taskIndex;
+    __m256d dc_im = _mm256_set1_pd((j - args->height / 2) * args->dy);
+
+    for (int i = 0; i < width; i += VECTOR_WIDTH) {
+        __m128i ii = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+        __m256d dc_re = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_sub_epi32(ii, _mm_set1_epi32(width / 2))),
+                                      _mm256_set1_pd(args->dx));
+
+        __m128i valid = _mm_cmpgt_epi32(_mm_set1_epi32(width), ii);
+        __m256d active = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(valid));
+
+        // the series, as in deepPixel()
+        __m256d d_re = _mm256_setzero_pd(), d_im = _mm256_setzero_pd();
+        for (int k = SERIES_TERMS - 1; k >= 0; k--) {
+            __m256d t_re = _mm256_add_pd(d_re, _mm256_set1_pd(args->seriesRe[k]));
+            __m256d t_im = _mm256_add_pd(d_im, _mm256_set1_pd(args->seriesIm[k]));
+            d_re = _mm256_sub_pd(_mm256_mul_pd(t_re, dc_re), _mm256_mul_pd(t_im, dc_im));
+            d_im = _mm256_add_pd(_mm256_mul_pd(t_re, dc_im), _mm256_mul_pd(t_im, dc_re));
+        }
+        __m128i m = _mm_set1_epi32(args->skip);
+        __m256d count = _mm256_set1_pd(args->skip - 1);
+
+        for (int k = args->skip - 1; k < args->maxIterations; ++k) {
+            // Until lanes rebase differently they share one reference
+            // index, and a broadcast is much cheaper than a gather.
+            __m256d Z_re, Z_im;
+            int m0 = _mm_cvtsi128_si32(m);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(m, _mm_set1_epi32(m0))) == 0xffff) {
+                Z_re = _mm256_broadcast_sd(refRe + m0);
+                Z_im = _mm256_broadcast_sd(refIm + m0);
+            } else {
+                Z_re = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), refRe, m, allLanes, 8);
+                Z_im = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), refIm, m, allLanes, 8);
+            }
+            __m256d z_re = _mm256_add_pd(Z_re, d_re);
+            __m256d z_im = _mm256_add_pd(Z_im, d_im);
+            __m256d mag = _mm256_add_pd(_mm256_mul_pd(z_re, z_re), _mm256_mul_pd(z_im, z_im));
+
+            active = _mm256_and_pd(active, _mm256_cmp_pd(mag, four, _CMP_NGT_UQ));
+            if (_mm256_testz_pd(active, active))
+                break;
+            count = _mm256_add_pd(count, _mm256_and_pd(active, one));
+
+            // rebase lanes onto Z_0 = 0
+            __m256d dmag = _mm256_add_pd(_mm256_mul_pd(d_re, d_re), _mm256_mul_pd(d_im, d_im));
+            __m128i atEnd = _mm_cmpeq_epi32(m, last);
+            __m256d rebase = _mm256_or_pd(_mm256_cmp_pd(mag, dmag, _CMP_LT_OQ),
+                                          _mm256_castsi256_pd(_mm256_cvtepi32_epi64(atEnd)));
+            rebase = _mm256_and_pd(rebase, active);
+            d_re = _mm256_blendv_pd(d_re, z_re, rebase);
+            d_im = _mm256_blendv_pd(d_im, z_im, rebase);
+            Z_re = _mm256_andnot_pd(rebase, Z_re);
+            Z_im = _mm256_andnot_pd(rebase, Z_im);
+            __m128i rebase32 = _mm256_castsi256_si128(
+                _mm256_permutevar8x32_epi32(_mm256_castpd_si256(rebase), packMask));
+            m = _mm_andnot_si128(rebase32, m);
+
+            __m256d a_re = _mm256_add_pd(_mm256_mul_pd(two, Z_re), d_re);
+            __m256d a_im = _mm256_add_pd(_mm256_mul_pd(two, Z_im), d_im);
+            __m256d new_re = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(a_re, d_re),
+                                                         _mm256_mul_pd(a_im, d_im)), dc_re);
+            __m256d new_im = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a_re, d_im),
+                                                         _mm256_mul_pd(a_im, d_re)), dc_im);
+
+            // escaped lanes keep their index so gathers stay in bounds
+            __m128i active32 = _mm256_castsi256_si128(
+                _mm256_permutevar8x32_epi32(_mm256_castpd_si256(active), packMask));
+            d_re = _mm256_blendv_pd(d_re, new_re, active);
+            d_im = _mm256_blendv_pd(d_im, new_im, active);
+            m = _mm_sub_epi32(m, active32);
+        }
+
+        _mm_maskstore_epi32(args->output + j * width + i, valid, _mm256_cvtpd_epi32(count));
+    }
+}
+
+//
+// deepRowTaskAVX512 --
+//
+// deepRowTaskAVX2() for 8 pixels at a time, with lane masks in place of
+// the blends and 64-bit reference indices.
+__attribute__((target("avx512f")))
+static void deepRowTaskAVX512(void *data, int threadIndex, int threadCount,
+                              int taskIndex, int taskCount) {
+    const DeepArgs * const args = (const DeepArgs *)data;
+
+    // 512 / sizeof(double) == 8
+    const int VECTOR_WIDTH = 8;
+
+    const double *refRe = args->refRe, *refIm = args->refIm;
+    const __m512i last = _mm512_set1_epi64(args->refLength - 1);
+    const __m512i oneIndex = _mm512_set1_epi64(1);
+    const __m512d four = _mm512_set1_pd(4.);
+    const __m512d two = _mm512_set1_pd(2.);
+
+    int width = args->width;
+    int j = taskIndex;
+    __m512d dc_im = _mm512_set1_pd((j - args->height / 2) * args->dy);
+
+    for (int i = 0; i < width; i += VECTOR_WIDTH) {
+        __m256i ii = _mm256_add_epi32(_mm256_set1_epi32(i - width / 2),
+                                      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m512d dc_re = _mm512_mul_pd(_mm512_maskz_cvtepi32_pd(0xff, ii), _mm512_set1_pd(args->dx));
+
+        __mmask8 valid = width - i >= VECTOR_WIDTH ? 0xff : (1 << (width - i)) - 1;
+        __mmask8 active = valid;
+
+        // the series, as in deepPixel()
+        __m512d d_re = _mm512_setzero_pd(), d_im = _mm512_setzero_pd();
+        for (int k = SERIES_TERMS - 1; k >= 0; k--) {
+            __m512d t_re = _mm512_add_pd(d_re, _mm512_set1_pd(args->seriesRe[k]));
+            __m512d t_im = _mm512_add_pd(d_im, _mm512_set1_pd(args->seriesIm[k]));
+            d_re = _mm512_sub_pd(_mm512_mul_pd(t_re, dc_re), _mm512_mul_pd(t_im, dc_im));
+            d_im = _mm512_add_pd(_mm512_mul_pd(t_re, dc_im), _mm512_mul_pd(t_im, dc_re));
+        }
+        __m512i m = _mm512_set1_epi64(args->skip);
+        __m512i count = _mm512_set1_epi64(args->skip - 1);
+
+        for (int k = args->skip - 1; k < args->maxIterations; ++k) {
+            __m512d Z_re, Z_im;
+            long long m0 = _mm_cvtsi128_si64(_mm512_maskz_extracti32x4_epi32(0xf, m, 0));
+            if (_mm512_cmpneq_epi64_mask(m, _mm512_set1_epi64(m0)) == 0) {
+                Z_re = _mm512_set1_pd(refRe[m0]);
+                Z_im = _mm512_set1_pd(refIm[m0]);
+            } else {
+                Z_re = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xff, m, refRe, 8);
+                Z_im = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xff, m, refIm, 8);
+            }
+            __m512d z_re = _mm512_add_pd(Z_re, d_re);
+            __m512d z_im = _mm512_add_pd(Z_im, d_im);
+            __m512d mag = _mm512_add_pd(_mm512_mul_pd(z_re, z_re), _mm512_mul_pd(z_im, z_im));
+
+            active = _mm512_mask_cmp_pd_mask(active, mag, four, _CMP_NGT_UQ);
+            if (!active)
+                break;
+            count = _mm512_mask_add_epi64(count, active, count, oneIndex);
+
+            // rebase lanes onto Z_0 = 0
+            __m512d dmag = _mm512_add_pd(_mm512_mul_pd(d_re, d_re), _mm512_mul_pd(d_im, d_im));
+            __mmask8 rebase = _mm512_mask_cmp_pd_mask(active, mag, dmag, _CMP_LT_OQ) |
+                _mm512_mask_cmpeq_epi64_mask(active, m, last);
+            d_re = _mm512_mask_mov_pd(d_re, rebase, z_re);
+            d_im = _mm512_mask_mov_pd(d_im, rebase, z_im);
+            Z_re = _mm512_maskz_mov_pd(~rebase, Z_re);
+            Z_im = _mm512_maskz_mov_pd(~rebase, Z_im);
+            m = _mm512_maskz_mov_epi64(~rebase, m);
+
+            __m512d a_re = _mm512_add_pd(_mm512_mul_pd(two, Z_re), d_re);
+            __m512d a_im = _mm512_add_pd(_mm512_mul_pd(two, Z_im), d_im);
+            __m512d new_re = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(a_re, d_re),
+                                                         _mm512_mul_pd(a_im, d_im)), dc_re);
+            __m512d new_im = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(a_re, d_im),
+                                                         _mm512_mul_pd(a_im, d_re)), dc_im);
+
+            // escaped lanes keep their index so gathers stay in bounds
+            d_re = _mm512_mask_mov_pd(d_re, active, new_re);
+            d_im = _mm512_mask_mov_pd(d_im, active, new_im);
+            m = _mm512_mask_add_epi64(m, active, m, oneIndex);
+        }
+
+        _mm512_mask_cvtepi64_storeu_epi32(args->output + j * width + i, valid, count);
+    }
+}
+
+//
+// MandelbrotDeep --
+//
+// Renders the view of the given radius (half its height in the complex
+// plane) around (centerX, centerY) with perturbation iteration, on the
+// thread pool.  The kernel option picks the AVX-512, AVX2 or scalar
+// delta loop; stats, if given, receive how far the series approximation
+// got along the reference orbit.
+void mandelbrotDeep(
+    int numThreads,
+    DoubleDouble centerX, DoubleDouble centerY, double radius,
+    int width, int height,
+    int maxIterations, int output[],
+    const MandelOptions &options, MandelDeepStats *stats)
+{
+    std::vector<double> refRe, refIm;
+    computeReferenceOrbit(centerX, centerY, maxIterations, refRe, refIm);
+
+    DeepArgs args;
+    args.width = width;
+    args.height = height;
+    args.maxIterations = maxIterations;
+    args.output = output;
+    args.dy = 2. * radius / height;
+    args.dx = args.dy;
+    args.refRe = refRe.data();
+    args.refIm = refIm.data();
+    args.refLength = refRe.size();
+    args.centerX = centerX;
+    args.centerY = centerY;
+    seriesApproximation(&args);
+
+    if (stats) {
+        stats->referenceLength = args.refLength - 2;
+        stats->skipped = args.skip - 1;
+    }
+
+    PoolTaskFunc rowTask = deepRowTask;
+    switch (resolveMandelKernel(options.kernel)) {
+    case KERNEL_AVX2:
+        rowTask = deepRowTaskAVX2;
+        break;
+    case KERNEL_AVX512:
+        rowTask = deepRowTaskAVX512;
+        break;
+    default:
+        break;
+    }
+
+    getThreadPool(numThreads)->run(rowTask, &args, height);
+}
+
+static void directRowTask(void *data, int threadIndex, int threadCount,
+                          int taskIndex, int taskCount) {
+    const DeepArgs * const args = (const DeepArgs *)data;
+
+    int j = taskIndex;
+    double c_im = (args->centerY + DoubleDouble((j - args->height / 2) * args->dy)).toDouble();
+    for (int i = 0; i < args->width; i++) {
+        double c_re = (args->centerX + DoubleDouble((i - args->width / 2) * args->dx)).toDouble();
+
+        double z_re = c_re, z_im = c_im;
+        int k;
+        for (k = 0; k < args->maxIterations; ++k) {
+            if (z_re * z_re + z_im * z_im > 4.)
+                break;
+            double new_re = z_re*z_re - z_im*z_im;
+            double new_im = 2. * z_re * z_im;
+            z_re = c_re + new_re;
+            z_im = c_im + new_im;
+        }
+        args->output[j * args->width + i] = k;
+    }
+}
+
+//
+// MandelbrotDeepDirect --
+//
+// Same view as mandelbrotDeep(), iterated directly in double precision.
+// Only meaningful while double can still tell pixels apart (radius
+// above ~1e-12); used to check the perturbation renderer.
+void mandelbrotDeepDirect(
+    int numThreads,
+    DoubleDouble centerX, DoubleDouble centerY, double radius,
+    int width, int height,
+    int maxIterations, int output[])
+{
+    DeepArgs args;
+    args.width = width;
+    args.height = height;
+    args.maxIterations = maxIterations;
+    args.output = output;
+    args.dy = 2. * radius / height;
+    args.dx = args.dy;
+    args.centerX = centerX;
+    args.centerY = centerY;
+
+    getThreadPool(numThreads)->run(directRowTask, &args, height);
+}
+
+static void referenceRowTask(void *data, int threadIndex, int threadCount,
+                             int taskIndex, int taskCount) {
+    const DeepArgs * const args = (const DeepArgs *)data;
+
+    int j = taskIndex * args->step;
+    DoubleDouble c_im = args->centerY + DoubleDouble((j - args->height / 2) * args->dy);
+    for (int i = 0; i < args->width; i += args->step) {
+        DoubleDouble c_re = args->centerX + DoubleDouble((i - args->width / 2) * args->dx);
+
+        DoubleDouble z_re = c_re, z_im = c_im;
+        int k;
+        for (k = 0; k < args->maxIterations; ++k) {
+            double re = z_re.toDouble(), im = z_im.toDouble();
+            if (re * re + im * im > 4.)
+                break;
+            DoubleDouble new_re = z_re*z_re - z_im*z_im;
+            DoubleDouble new_im = ddTimes2(z_re * z_im);
+            z_re = c_re + new_re;
+            z_im = c_im + new_im;
+        }
+        args->output[j * args->width + i] = k;
+    }
+}
+
+//
+// MandelbrotDeepReference --
+//
+// Same view as mandelbrotDeep(), iterated directly in double-double, but
+// only for every step-th pixel of every step-th row; the other pixels of
+// output are left alone.  Much slower than perturbation; it is used to
+// check it where mandelbrotDeepDirect() can no longer tell pixels apart,
+// down to radii around 1e-20, where its own rounding starts to show.
+void mandelbrotDeepReference(
+    int numThreads,
+    DoubleDouble centerX, DoubleDouble centerY, double radius,
+    int width, int height, int step,
+    int maxIterations, int output[])
+{
+    DeepArgs args;
+    args.width = width;
+    args.height = height;
+    args.maxIterations = maxIterations;
+    args.output = output;
+    args.dy = 2. * radius / height;
+    args.dx = args.dy;
+    args.centerX = centerX;
+    args.centerY = centerY;
+    args.step = step;
+
+    getThreadPool(numThreads)->run(referenceRowTask, &args, (height + step - 1) / step);
+}
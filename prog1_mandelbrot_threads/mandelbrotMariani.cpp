@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "mandelbrot.h"
+#include "threadPool.h"
+
+/*
+  Mariani-Silver rendering.
+
+  The image is cut into square tiles that run as tasks on the thread
+  pool.  For each tile only the border is computed.  If every border
+  pixel has the same iteration count, the interior is assumed to have it
+  as well and is filled without iterating.  Otherwise the rectangle is
+  split in four by computing one row and one column through its middle,
+  and each quarter (whose border is now known) is handled the same way.
+  Rectangles below MIN_SPLIT_SIZE are computed pixel by pixel.
+  Subdivision goes breadth first within a tile, one level of rectangles
+  at a time.
+
+  Spans of at least MIN_TILE_COLS pixels of a row go through the tile
+  kernel.  Columns and narrow blocks would leave most of its lanes idle,
+  so their pixels are queued in a PointBatch and run through the
+  point-list kernel instead, a full vector at a time.  The queue is
+  flushed before the borders of each level are examined.
+
+  Filling is approximate: it relies on the set being connected, but a
+  uniform border can still enclose thin filaments or small escaping
+  regions that never touch it, so the output may differ from
+  mandelbrotSerial() in a few pixels.
+ */
+
+static const int TILE_SIZE = 64;
+static const int MIN_SPLIT_SIZE = 6;
+// narrower spans are computed through the point-list kernel
+static const int MIN_TILE_COLS = 16;
+static const int POINT_BATCH = 256;
+
+typedef struct {
+    float x0, x1;
+    float y0, y1;
+    int width;
+    int height;
+    int maxIterations;
+    int* output;
+    MandelTileFunc tileFunc;
+    MandelPointsFunc pointsFunc;
+    int tilesX;
+
+    std::atomic<long long> numIterated;
+    std::atomic<long long> numFilled;
+} MarianiArgs;
+
+
+// Pixels waiting for the point-list kernel.
+typedef struct {
+    int cols[POINT_BATCH];
+    int rows[POINT_BATCH];
+    int count;
+} PointBatch;
+
+static void flushPoints(MarianiArgs *args, PointBatch *batch) {
+    if (batch->count == 0)
+        return;
+
+    float xs[POINT_BATCH], ys[POINT_BATCH];
+    int counts[POINT_BATCH];
+    float dx = (args->x1 - args->x0) / args->width;
+    float dy = (args->y1 - args->y0) / args->height;
+    for (int k = 0; k < batch->count; k++) {
+        xs[k] = args->x0 + batch->cols[k] * dx;
+        ys[k] = args->y0 + batch->rows[k] * dy;
+    }
+    args->pointsFunc(xs, ys, batch->count, args->maxIterations, counts);
+
+    for (int k = 0; k < batch->count; k++)
+        args->output[batch->rows[k] * args->width + batch->cols[k]] = counts[k];
+    batch->count = 0;
+}
+
+//
+// computeBlock --
+//
+// Computes a rectangle of pixels: right away through the tile kernel if
+// it is wide enough, otherwise by queueing them in batch.
+static void computeBlock(MarianiArgs *args, PointBatch *batch,
+                         int startRow, int numRows,
+                         int startCol, int numCols, long long *iterated) {
+    if (numRows <= 0 || numCols <= 0)
+        return;
+
+    *iterated += (long long)numRows * numCols;
+
+    if (numCols >= MIN_TILE_COLS) {
+        args->tileFunc(args->x0, args->y0, args->x1, args->y1,
+                       args->width, args->height,
+                       startRow, numRows, startCol, numCols,
+                       args->maxIterations, args->output);
+        return;
+    }
+
+    for (int j = startRow; j < startRow + numRows; j++) {
+        for (int i = startCol; i < startCol + numCols; i++) {
+            if (batch->count == POINT_BATCH)
+                flushPoints(args, batch);
+            batch->cols[batch->count] = i;
+            batch->rows[batch->count] = j;
+            batch->count++;
+        }
+    }
+}
+
+// Rectangle with corners (r0, c0) and (r1, c1), inclusive.
+typedef struct {
+    int r0, c0, r1, c1;
+} Rect;
+
+//
+// subdivide --
+//
+// Handles a rectangle whose border pixels have already been computed.
+// Its interior is either filled, computed (possibly queued in batch), or
+// split by queueing a cross through its middle, in which case the four
+// quarters are appended to next.  Only the interior is written.
+static void subdivide(MarianiArgs *args, PointBatch *batch, const Rect &rect,
+                      std::vector<Rect> *next, long long *iterated, long long *filled) {
+    int r0 = rect.r0, c0 = rect.c0, r1 = rect.r1, c1 = rect.c1;
+    int innerRows = r1 - r0 - 1;
+    int innerCols = c1 - c0 - 1;
+    if (innerRows <= 0 || innerCols <= 0)
+        return;
+
+    int width = args->width;
+    int *output = args->output;
+    int value = output[r0 * width + c0];
+    bool uniform = true;
+
+    for (int i = c0; i <= c1 && uniform; i++)
+        uniform = output[r0 * width + i] == value && output[r1 * width + i] == value;
+    for (int j = r0 + 1; j < r1 && uniform; j++)
+        uniform = output[j * width + c0] == value && output[j * width + c1] == value;
+
+    if (uniform) {
+        for (int j = r0 + 1; j < r1; j++)
+            for (int i = c0 + 1; i < c1; i++)
+                output[j * width + i] = value;
+        *filled += (long long)innerRows * innerCols;
+        return;
+    }
+
+    if (innerRows < MIN_SPLIT_SIZE || innerCols < MIN_SPLIT_SIZE) {
+        computeBlock(args, batch, r0 + 1, innerRows, c0 + 1, innerCols, iterated);
+        return;
+    }
+
+    int rm = (r0 + r1) / 2;
+    int cm = (c0 + c1) / 2;
+    computeBlock(args, batch, rm, 1, c0 + 1, innerCols, iterated);
+    computeBlock(args, batch, r0 + 1, rm - r0 - 1, cm, 1, iterated);
+    computeBlock(args, batch, rm + 1, r1 - rm - 1, cm, 1, iterated);
+
+    Rect quarters[4] = {
+        { r0, c0, rm, cm }, { r0, cm, rm, c1 },
+        { rm, c0, r1, cm }, { rm, cm, r1, c1 },
+    };
+    next->insert(next->end(), quarters, quarters + 4);
+}
+
+//
+// marianiTileTask --
+//
+// Pool task entrypoint: computes the border of one tile, then
+// subdivides it one level at a time, so that the pixels queued by all
+// the rectangles of a level share the point-list kernel's vectors.
+static void marianiTileTask(void *data, int threadIndex, int threadCount,
+                            int taskIndex, int taskCount) {
+    MarianiArgs * const args = (MarianiArgs *)data;
+
+    Rect tile;
+    tile.r0 = (taskIndex / args->tilesX) * TILE_SIZE;
+    tile.c0 = (taskIndex % args->tilesX) * TILE_SIZE;
+    tile.r1 = std::min(tile.r0 + TILE_SIZE, args->height) - 1;
+    tile.c1 = std::min(tile.c0 + TILE_SIZE, args->width) - 1;
+
+    long long iterated = 0, filled = 0;
+    PointBatch batch;
+    batch.count = 0;
+
+    int r0 = tile.r0, c0 = tile.c0, r1 = tile.r1, c1 = tile.c1;
+    computeBlock(args, &batch, r0, 1, c0, c1 - c0 + 1, &iterated);
+    if (r1 > r0)
+        computeBlock(args, &batch, r1, 1, c0, c1 - c0 + 1, &iterated);
+    computeBlock(args, &batch, r0 + 1, r1 - r0 - 1, c0, 1, &iterated);
+    if (c1 > c0)
+        computeBlock(args, &batch, r0 + 1, r1 - r0 - 1, c1, 1, &iterated);
+
+    std::vector<Rect> level(1, tile), next;
+    while (!level.empty()) {
+        // the borders of this level may still be queued
+        flushPoints(args, &batch);
+
+        next.clear();
+        for (size_t k = 0; k < level.size(); k++)
+            subdivide(args, &batch, level[k], &next, &iterated, &filled);
+        level.swap(next);
+    }
+    flushPoints(args, &batch);
+
+    args->numIterated += iterated;
+    args->numFilled += filled;
+}
+
+//
+// MandelbrotMariani --
+//
+// Renders the image with Mariani-Silver subdivision on the thread pool,
+// using the per-pixel kernel selected by options.  If stats is non-NULL
+// it receives the number of pixels that were iterated and filled.
+void mandelbrotMariani(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations, int output[],
+    const MandelOptions &options,
+    MandelFillStats *stats)
+{
+    MarianiArgs args;
+    args.x0 = x0;
+    args.y0 = y0;
+    args.x1 = x1;
+    args.y1 = y1;
+    args.width = width;
+    args.height = height;
+    args.maxIterations = maxIterations;
+    args.output = output;
+    args.tileFunc = getMandelTileFunc(options.kernel, options.cullInterior);
+    args.pointsFunc = getMandelPointsFunc(options.kernel, options.cullInterior);
+    args.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    args.numIterated = 0;
+    args.numFilled = 0;
+
+    int numTiles = args.tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE);
+    getThreadPool(numThreads)->run(marianiTileTask, &args, numTiles);
+
+    if (stats) {
+        stats->numIterated = args.numIterated;
+        stats->numFilled = args.numFilled;
+    }
+}
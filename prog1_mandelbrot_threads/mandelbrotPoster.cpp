@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "mandelbrot.h"
+#include "threadPool.h"
+
+struct PGMStream;
+extern PGMStream *openPGMStream(const char *filename, int width, int height,
+                                int maxIterations, int bitDepth);
+extern void writePGMRows(PGMStream *stream, const int *data, int numRows);
+extern bool closePGMStream(PGMStream *stream);
+
+/*
+  Poster rendering: images too large to hold as one int buffer.
+
+  The image is rendered in bands of rows.  Only two bands are in memory:
+  while the workers compute band k+1 on the thread pool, the calling
+  thread quantizes band k and appends it to the output file.  Memory use
+  therefore depends on the width and band height, never on the image
+  height.
+
+  Each row is passed to the tile kernel as a one-row image whose y0 is
+  the row's coordinate, computed exactly as the kernels compute it for
+  the full image.  That keeps the output identical to an in-memory
+  render and keeps every index the kernels compute below width.
+ */
+
+typedef struct {
+    float x0, x1;
+    float y0, dy;
+    int width;
+    int maxIterations;
+    int* output;
+    MandelTileFunc tileFunc;
+    int startRow;
+} BandArgs;
+
+
+//
+// bandRowTask --
+//
+// Pool task entrypoint: computes one row of the band.
+static void bandRowTask(void *data, int threadIndex, int threadCount,
+                        int taskIndex, int taskCount) {
+    const BandArgs * const args = (const BandArgs *)data;
+
+    // y = y0 + j * dy, as in the kernels
+    float y = args->y0 + (args->startRow + taskIndex) * args->dy;
+    args->tileFunc(args->x0, y, args->x1, y + args->dy,
+                   args->width, 1, 0, 1, 0, args->width,
+                   args->maxIterations, args->output + (size_t)taskIndex * args->width);
+}
+
+//
+// MandelbrotPoster --
+//
+// Renders a width x height image to filename as an 8 or 16-bit PGM,
+// bandHeight rows at a time.  Returns false if the file could not be
+// written.  If stats is non-NULL it receives the timing of the render
+// and the size of the buffers it used.
+bool mandelbrotPoster(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    int bandHeight, int bitDepth,
+    const char *filename,
+    const MandelOptions &options,
+    MandelPosterStats *stats)
+{
+    PGMStream *stream = openPGMStream(filename, width, height, maxIterations, bitDepth);
+    if (!stream)
+        return false;
+
+    ThreadPool *pool = getThreadPool(numThreads);
+    bandHeight = std::max(1, std::min(bandHeight, height));
+    int numBands = (height + bandHeight - 1) / bandHeight;
+
+    std::vector<int> buffers[2];
+    BandArgs args[2];
+    PoolBatch batches[2];
+    for (int b = 0; b < 2; b++) {
+        buffers[b].resize((size_t)bandHeight * width);
+        args[b].x0 = x0;
+        args[b].x1 = x1;
+        args[b].y0 = y0;
+        args[b].dy = (y1 - y0) / height;
+        args[b].width = width;
+        args[b].maxIterations = maxIterations;
+        args[b].output = buffers[b].data();
+        args[b].tileFunc = getMandelTileFunc(options.kernel, options.cullInterior);
+    }
+
+    double waitSeconds = 0, writeSeconds = 0;
+    double startTime = CycleTimer::currentSeconds();
+
+    for (int band = 0; band <= numBands; band++) {
+        // Launch this band while the previous one is written.
+        if (band < numBands) {
+            BandArgs &a = args[band % 2];
+            a.startRow = band * bandHeight;
+            pool->launch(bandRowTask, &a, std::min(bandHeight, height - a.startRow),
+                         &batches[band % 2]);
+        }
+
+        int done = band - 1;
+        if (done < 0)
+            continue;
+
+        double syncStart = CycleTimer::currentSeconds();
+        pool->sync(&batches[done % 2]);
+        double syncEnd = CycleTimer::currentSeconds();
+        writePGMRows(stream, buffers[done % 2].data(),
+                     std::min(bandHeight, height - done * bandHeight));
+        waitSeconds += syncEnd - syncStart;
+        writeSeconds += CycleTimer::currentSeconds() - syncEnd;
+    }
+
+    bool ok = closePGMStream(stream);
+
+    if (stats) {
+        stats->numBands = numBands;
+        stats->bufferBytes = 2 * buffers[0].size() * sizeof(int);
+        stats->seconds = CycleTimer::currentSeconds() - startTime;
+        stats->waitSeconds = waitSeconds;
+        stats->writeSeconds = writeSeconds;
+    }
+    return ok;
+}
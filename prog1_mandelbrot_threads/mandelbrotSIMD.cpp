@@ -0,0 +1,505 @@
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "mandelbrot.h"
+
+/*
+  Hand-vectorized versions of mandelbrotSerialTile().
+
+  Each vector holds 8 (AVX2) or 16 (AVX-512) horizontally adjacent pixels
+  of a row.  Lanes whose pixel has escaped are masked off and stop
+  counting iterations, and the loop exits as soon as every lane has
+  escaped.  The kernels are compiled with per-function target attributes
+  so this file builds without -mavx2, and getMandelTileFunc() only hands
+  them out after checking CPUID.
+
+  With Cull set, the kernels apply the same interior tests as
+  mandelCull() in mandelbrotSerial.cpp, lane by lane.
+
+  The results match the scalar mandel() bit for bit: coordinates are
+  computed with the same float operations in the same order, and the
+  escape test is "not greater than 4" so NaNs behave as in the scalar
+  loop.  AVX-512F does include FMA instructions, so the Makefile builds
+  with -ffp-contract=off to keep the compiler from fusing multiplies and
+  adds.
+
+  The counts are computed in 32-bit lanes and narrowed only when stored,
+  for uint16_t and uint8_t output.
+
+  The point-list kernels (see MandelPointsFunc) load each lane's point
+  from the lists instead, for renderers whose pixels are not laid out in
+  rows: borders, strided samples and cache misses.
+ */
+
+//
+// storeCountsAVX2 --
+//
+// Stores the first n (1 to 8) lanes of count to dst.
+template <typename T>
+__attribute__((target("avx2")))
+static inline void storeCountsAVX2(T *dst, __m256i count, __m256i valid, int n);
+
+template <>
+__attribute__((target("avx2")))
+inline void storeCountsAVX2<int>(int *dst, __m256i count, __m256i valid, int n) {
+    _mm256_maskstore_epi32(dst, valid, count);
+}
+
+template <>
+__attribute__((target("avx2")))
+inline void storeCountsAVX2<uint16_t>(uint16_t *dst, __m256i count, __m256i valid, int n) {
+    // counts are non-negative and fit, so unsigned saturation is exact
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(count),
+                                      _mm256_extracti128_si256(count, 1));
+    if (n == 8) {
+        _mm_storeu_si128((__m128i *)dst, packed);
+    } else {
+        uint16_t lanes[8];
+        _mm_storeu_si128((__m128i *)lanes, packed);
+        for (int k = 0; k < n; k++)
+            dst[k] = lanes[k];
+    }
+}
+
+template <>
+__attribute__((target("avx2")))
+inline void storeCountsAVX2<uint8_t>(uint8_t *dst, __m256i count, __m256i valid, int n) {
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(count),
+                                      _mm256_extracti128_si256(count, 1));
+    packed = _mm_packus_epi16(packed, packed);
+    if (n == 8) {
+        _mm_storel_epi64((__m128i *)dst, packed);
+    } else {
+        uint8_t lanes[16];
+        _mm_storeu_si128((__m128i *)lanes, packed);
+        for (int k = 0; k < n; k++)
+            dst[k] = lanes[k];
+    }
+}
+
+//
+// storeCountsAVX512 --
+//
+// Stores the lanes of count selected by valid to dst.
+template <typename T>
+__attribute__((target("avx512f")))
+static inline void storeCountsAVX512(T *dst, __m512i count, __mmask16 valid);
+
+template <>
+__attribute__((target("avx512f")))
+inline void storeCountsAVX512<int>(int *dst, __m512i count, __mmask16 valid) {
+    _mm512_mask_storeu_epi32(dst, valid, count);
+}
+
+template <>
+__attribute__((target("avx512f")))
+inline void storeCountsAVX512<uint16_t>(uint16_t *dst, __m512i count, __mmask16 valid) {
+    _mm512_mask_cvtusepi32_storeu_epi16(dst, valid, count);
+}
+
+template <>
+__attribute__((target("avx512f")))
+inline void storeCountsAVX512<uint8_t>(uint8_t *dst, __m512i count, __mmask16 valid) {
+    _mm512_mask_cvtusepi32_storeu_epi8(dst, valid, count);
+}
+
+//
+// interiorAVX2 --
+//
+// inMainCardioidOrBulb() for 4 points, in double like the scalar test.
+__attribute__((target("avx2"), always_inline))
+static inline __m256d interiorAVX2(__m256d x, __m256d y)
+{
+    const __m256d margin = _mm256_set1_pd(CULL_MARGIN);
+    __m256d y2 = _mm256_mul_pd(y, y);
+    __m256d xq = _mm256_sub_pd(x, _mm256_set1_pd(.25));
+    __m256d q = _mm256_add_pd(_mm256_mul_pd(xq, xq), y2);
+    __m256d cardioid = _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, xq)),
+                                     _mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(.25), y2), margin),
+                                     _CMP_LT_OQ);
+    __m256d xb = _mm256_add_pd(x, _mm256_set1_pd(1.));
+    __m256d bulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(xb, xb), y2),
+                                 _mm256_sub_pd(_mm256_set1_pd(.0625), margin), _CMP_LT_OQ);
+    return _mm256_or_pd(cardioid, bulb);
+}
+
+//
+// interiorAVX512 --
+//
+// inMainCardioidOrBulb() for 8 points, in double like the scalar test.
+__attribute__((target("avx512f"), always_inline))
+static inline __mmask8 interiorAVX512(__m512d x, __m512d y)
+{
+    const __m512d margin = _mm512_set1_pd(CULL_MARGIN);
+    __m512d y2 = _mm512_mul_pd(y, y);
+    __m512d xq = _mm512_sub_pd(x, _mm512_set1_pd(.25));
+    __m512d q = _mm512_add_pd(_mm512_mul_pd(xq, xq), y2);
+    __mmask8 cardioid = _mm512_cmp_pd_mask(_mm512_mul_pd(q, _mm512_add_pd(q, xq)),
+                                           _mm512_sub_pd(_mm512_mul_pd(_mm512_set1_pd(.25), y2), margin),
+                                           _CMP_LT_OQ);
+    __m512d xb = _mm512_add_pd(x, _mm512_set1_pd(1.));
+    __mmask8 bulb = _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(xb, xb), y2),
+                                       _mm512_sub_pd(_mm512_set1_pd(.0625), margin), _CMP_LT_OQ);
+    return cardioid | bulb;
+}
+
+//
+// mandelVectorAVX2 --
+//
+// Iteration counts of the 8 points (c_re, c_im), for the lanes set in
+// active; the other lanes come out 0.
+template <bool Cull>
+__attribute__((target("avx2"), always_inline))
+static inline __m256i mandelVectorAVX2(__m256 c_re, __m256 c_im, __m256 active,
+                                       int maxIterations)
+{
+    const __m256 four = _mm256_set1_ps(4.f);
+    const __m256 two = _mm256_set1_ps(2.f);
+
+    __m256 z_re = c_re, z_im = c_im;
+    __m256i count = _mm256_setzero_si256();
+
+    __m256 saved_re = z_re, saved_im = z_im;
+    int period = 1, steps = 0;
+
+    if (Cull) {
+        // lanes in the main cardioid or period-2 bulb are done
+        // before the first iteration (see inMainCardioidOrBulb())
+        __m256d lo = interiorAVX2(_mm256_cvtps_pd(_mm256_castps256_ps128(c_re)),
+                                  _mm256_cvtps_pd(_mm256_castps256_ps128(c_im)));
+        __m256d hi = interiorAVX2(_mm256_cvtps_pd(_mm256_extractf128_ps(c_re, 1)),
+                                  _mm256_cvtps_pd(_mm256_extractf128_ps(c_im, 1)));
+        // narrow the two 64-bit lane masks to one 32-bit lane mask
+        __m256 both = _mm256_permutevar8x32_ps(
+            _mm256_shuffle_ps(_mm256_castpd_ps(lo), _mm256_castpd_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+
+        __m256 interior = _mm256_and_ps(active, both);
+        count = _mm256_castps_si256(
+            _mm256_blendv_ps(_mm256_castsi256_ps(count),
+                             _mm256_castsi256_ps(_mm256_set1_epi32(maxIterations)),
+                             interior));
+        active = _mm256_andnot_ps(interior, active);
+    }
+
+    for (int k = 0; k < maxIterations; ++k) {
+        __m256 re2 = _mm256_mul_ps(z_re, z_re);
+        __m256 im2 = _mm256_mul_ps(z_im, z_im);
+
+        // if (z_re * z_re + z_im * z_im > 4.f) break;
+        __m256 mag = _mm256_add_ps(re2, im2);
+        active = _mm256_and_ps(active, _mm256_cmp_ps(mag, four, _CMP_NGT_UQ));
+        if (_mm256_testz_ps(active, active))
+            break;
+
+        // active lanes are all ones, i.e. -1
+        count = _mm256_sub_epi32(count, _mm256_castps_si256(active));
+
+        // escaped lanes keep iterating, but their results are
+        // never counted again
+        __m256 new_re = _mm256_sub_ps(re2, im2);
+        __m256 new_im = _mm256_mul_ps(_mm256_mul_ps(two, z_re), z_im);
+        z_re = _mm256_add_ps(c_re, new_re);
+        z_im = _mm256_add_ps(c_im, new_im);
+
+        if (Cull) {
+            // lanes whose orbit returned exactly to the saved
+            // value are periodic and finish with maxIterations
+            __m256 cycled = _mm256_and_ps(
+                _mm256_cmp_ps(z_re, saved_re, _CMP_EQ_OQ),
+                _mm256_cmp_ps(z_im, saved_im, _CMP_EQ_OQ));
+            cycled = _mm256_and_ps(active, cycled);
+            count = _mm256_castps_si256(
+                _mm256_blendv_ps(_mm256_castsi256_ps(count),
+                                 _mm256_castsi256_ps(_mm256_set1_epi32(maxIterations)),
+                                 cycled));
+            active = _mm256_andnot_ps(cycled, active);
+
+            if (++steps == period) {
+                saved_re = z_re;
+                saved_im = z_im;
+                steps = 0;
+                period *= 2;
+            }
+        }
+    }
+
+    return count;
+}
+
+template <bool Cull, typename T>
+__attribute__((target("avx2")))
+static void mandelbrotTileAVX2(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[])
+{
+    // 256 / sizeof(float) == 8
+    const int VECTOR_WIDTH = 8;
+
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    int endRow = startRow + numRows;
+    int endCol = startCol + numCols;
+
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int j = startRow; j < endRow; j++) {
+        float y = y0 + j * dy;
+        __m256 c_im = _mm256_set1_ps(y);
+
+        for (int i = startCol; i < endCol; i += VECTOR_WIDTH) {
+            // x = x0 + i * dx, for 8 consecutive i
+            __m256i ii = _mm256_add_epi32(_mm256_set1_epi32(i), laneIndex);
+            __m256 c_re = _mm256_add_ps(_mm256_set1_ps(x0),
+                                        _mm256_mul_ps(_mm256_cvtepi32_ps(ii),
+                                                      _mm256_set1_ps(dx)));
+
+            // lanes past the end of the tile never become active
+            __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(endCol), ii);
+
+            __m256i count = mandelVectorAVX2<Cull>(c_re, c_im, _mm256_castsi256_ps(valid),
+                                                   maxIterations);
+            storeCountsAVX2(output + j * width + i, count, valid,
+                            std::min(VECTOR_WIDTH, endCol - i));
+        }
+    }
+}
+
+//
+// mandelbrotPointsAVX2 --
+//
+// Point-list version of mandelbrotTileAVX2(): 8 points of the lists at
+// a time, wherever they are in the plane.
+template <bool Cull>
+__attribute__((target("avx2")))
+static void mandelbrotPointsAVX2(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[])
+{
+    const int VECTOR_WIDTH = 8;
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int k = 0; k < numPoints; k += VECTOR_WIDTH) {
+        __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(numPoints - k), laneIndex);
+        __m256 c_re = _mm256_maskload_ps(xs + k, valid);
+        __m256 c_im = _mm256_maskload_ps(ys + k, valid);
+
+        __m256i count = mandelVectorAVX2<Cull>(c_re, c_im, _mm256_castsi256_ps(valid),
+                                               maxIterations);
+        _mm256_maskstore_epi32(output + k, valid, count);
+    }
+}
+
+//
+// mandelVectorAVX512 --
+//
+// Iteration counts of the 16 points (c_re, c_im), for the lanes set in
+// active; the other lanes come out 0.
+template <bool Cull>
+__attribute__((target("avx512f"), always_inline))
+static inline __m512i mandelVectorAVX512(__m512 c_re, __m512 c_im, __mmask16 active,
+                                         int maxIterations)
+{
+    const __m512 four = _mm512_set1_ps(4.f);
+    const __m512 two = _mm512_set1_ps(2.f);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i maxCount = _mm512_set1_epi32(maxIterations);
+
+    __m512 z_re = c_re, z_im = c_im;
+    __m512i count = _mm512_setzero_si512();
+
+    __m512 saved_re = z_re, saved_im = z_im;
+    int period = 1, steps = 0;
+
+    if (Cull) {
+        // (the maskz forms avoid GCC's maybe-uninitialized warnings)
+        __mmask8 lo = interiorAVX512(
+            _mm512_maskz_cvtps_pd(0xff, _mm256_castpd_ps(
+                _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(c_re), 0))),
+            _mm512_maskz_cvtps_pd(0xff, _mm256_castpd_ps(
+                _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(c_im), 0))));
+        __mmask8 hi = interiorAVX512(
+            _mm512_maskz_cvtps_pd(0xff, _mm256_castpd_ps(
+                _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(c_re), 1))),
+            _mm512_maskz_cvtps_pd(0xff, _mm256_castpd_ps(
+                _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(c_im), 1))));
+
+        __mmask16 interior = active & (lo | (hi << 8));
+        count = _mm512_mask_mov_epi32(count, interior, maxCount);
+        active &= ~interior;
+    }
+
+    for (int k = 0; k < maxIterations; ++k) {
+        __m512 re2 = _mm512_mul_ps(z_re, z_re);
+        __m512 im2 = _mm512_mul_ps(z_im, z_im);
+
+        // if (z_re * z_re + z_im * z_im > 4.f) break;
+        __m512 mag = _mm512_add_ps(re2, im2);
+        active = _mm512_mask_cmp_ps_mask(active, mag, four, _CMP_NGT_UQ);
+        if (active == 0)
+            break;
+
+        count = _mm512_mask_add_epi32(count, active, count, one);
+
+        __m512 new_re = _mm512_sub_ps(re2, im2);
+        __m512 new_im = _mm512_mul_ps(_mm512_mul_ps(two, z_re), z_im);
+        z_re = _mm512_add_ps(c_re, new_re);
+        z_im = _mm512_add_ps(c_im, new_im);
+
+        if (Cull) {
+            __mmask16 cycled = _mm512_mask_cmp_ps_mask(active, z_re, saved_re, _CMP_EQ_OQ);
+            cycled = _mm512_mask_cmp_ps_mask(cycled, z_im, saved_im, _CMP_EQ_OQ);
+            count = _mm512_mask_mov_epi32(count, cycled, maxCount);
+            active &= ~cycled;
+
+            if (++steps == period) {
+                saved_re = z_re;
+                saved_im = z_im;
+                steps = 0;
+                period *= 2;
+            }
+        }
+    }
+
+    return count;
+}
+
+template <bool Cull, typename T>
+__attribute__((target("avx512f")))
+static void mandelbrotTileAVX512(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[])
+{
+    // 512 / sizeof(float) == 16
+    const int VECTOR_WIDTH = 16;
+
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    int endRow = startRow + numRows;
+    int endCol = startCol + numCols;
+
+    const __m512i laneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512 laneOffset = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7,
+                                             8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (int j = startRow; j < endRow; j++) {
+        float y = y0 + j * dy;
+        __m512 c_im = _mm512_set1_ps(y);
+
+        for (int i = startCol; i < endCol; i += VECTOR_WIDTH) {
+            // x = x0 + i * dx, for 16 consecutive i.  (float)i + lane is
+            // exact for any image width that fits in a float mantissa.
+            __m512i ii = _mm512_add_epi32(_mm512_set1_epi32(i), laneIndex);
+            __m512 fi = _mm512_add_ps(_mm512_set1_ps((float)i), laneOffset);
+            __m512 c_re = _mm512_add_ps(_mm512_set1_ps(x0),
+                                        _mm512_mul_ps(fi, _mm512_set1_ps(dx)));
+
+            __mmask16 valid = _mm512_cmpgt_epi32_mask(_mm512_set1_epi32(endCol), ii);
+
+            __m512i count = mandelVectorAVX512<Cull>(c_re, c_im, valid, maxIterations);
+            storeCountsAVX512(output + j * width + i, count, valid);
+        }
+    }
+}
+
+//
+// mandelbrotPointsAVX512 --
+//
+// Point-list version of mandelbrotTileAVX512(): 16 points of the lists
+// at a time, wherever they are in the plane.
+template <bool Cull>
+__attribute__((target("avx512f")))
+static void mandelbrotPointsAVX512(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[])
+{
+    const int VECTOR_WIDTH = 16;
+
+    for (int k = 0; k < numPoints; k += VECTOR_WIDTH) {
+        int n = std::min(VECTOR_WIDTH, numPoints - k);
+        __mmask16 valid = (__mmask16)((1u << n) - 1);
+        __m512 c_re = _mm512_maskz_loadu_ps(valid, xs + k);
+        __m512 c_im = _mm512_maskz_loadu_ps(valid, ys + k);
+
+        __m512i count = mandelVectorAVX512<Cull>(c_re, c_im, valid, maxIterations);
+        _mm512_mask_storeu_epi32(output + k, valid, count);
+    }
+}
+
+//
+// resolveMandelKernel --
+//
+// Turns KERNEL_AUTO into the widest kernel the CPU supports, and checks
+// that an explicitly requested kernel can run here.
+MandelKernel resolveMandelKernel(MandelKernel kernel) {
+    __builtin_cpu_init();
+    bool hasAVX512 = __builtin_cpu_supports("avx512f");
+    bool hasAVX2 = __builtin_cpu_supports("avx2");
+
+    if (kernel == KERNEL_AUTO)
+        return hasAVX512 ? KERNEL_AVX512 : hasAVX2 ? KERNEL_AVX2 : KERNEL_SCALAR;
+
+    if ((kernel == KERNEL_AVX512 && !hasAVX512) ||
+        (kernel == KERNEL_AVX2 && !hasAVX2)) {
+        fprintf(stderr, "Error: %s kernel is not supported by this CPU\n",
+                mandelKernelName(kernel));
+        exit(1);
+    }
+    return kernel;
+}
+
+const char *mandelKernelName(MandelKernel kernel) {
+    switch (kernel) {
+    case KERNEL_AUTO:   return "auto";
+    case KERNEL_SCALAR: return "scalar";
+    case KERNEL_AVX2:   return "avx2";
+    case KERNEL_AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+template <typename T>
+MandelTileFuncT<T> getMandelTileFuncT(MandelKernel kernel, bool cullInterior) {
+    switch (resolveMandelKernel(kernel)) {
+    case KERNEL_AVX2:
+        return cullInterior ? mandelbrotTileAVX2<true, T> : mandelbrotTileAVX2<false, T>;
+    case KERNEL_AVX512:
+        return cullInterior ? mandelbrotTileAVX512<true, T> : mandelbrotTileAVX512<false, T>;
+    default:
+        return cullInterior ? mandelbrotSerialTileCull<T> : mandelbrotSerialTile<T>;
+    }
+}
+
+template MandelTileFuncT<int> getMandelTileFuncT<int>(MandelKernel, bool);
+template MandelTileFuncT<uint16_t> getMandelTileFuncT<uint16_t>(MandelKernel, bool);
+template MandelTileFuncT<uint8_t> getMandelTileFuncT<uint8_t>(MandelKernel, bool);
+
+MandelTileFunc getMandelTileFunc(MandelKernel kernel, bool cullInterior) {
+    return getMandelTileFuncT<int>(kernel, cullInterior);
+}
+
+MandelPointsFunc getMandelPointsFunc(MandelKernel kernel, bool cullInterior) {
+    switch (resolveMandelKernel(kernel)) {
+    case KERNEL_AVX2:
+        return cullInterior ? mandelbrotPointsAVX2<true> : mandelbrotPointsAVX2<false>;
+    case KERNEL_AVX512:
+        return cullInterior ? mandelbrotPointsAVX512<true> : mandelbrotPointsAVX512<false>;
+    default:
+        return cullInterior ? mandelbrotSerialPointsCull : mandelbrotSerialPoints;
+    }
+}
@@ -37,6 +37,8 @@
    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "mandelbrot.h"
+
 
 static inline int mandel(float c_re, float c_im, int count)
 {
@@ -56,6 +58,74 @@ static inline int mandel(float c_re, float c_im, int count)
     return i;
 }
 
+//
+// inMainCardioidOrBulb --
+//
+// True if c lies in the main cardioid or the period-2 bulb.  Orbits of
+// these points never escape, so mandel() would run all iterations.
+//
+// The test runs in double (float loses q + xq to cancellation near the
+// cusp at -3/4) and only accepts points a margin CULL_MARGIN inside the
+// boundary: close to it the float orbit converges so slowly that
+// rounding can still let it escape.  Points in the margin are iterated.
+static inline bool inMainCardioidOrBulb(float c_re, float c_im)
+{
+    double y2 = (double)c_im * c_im;
+
+    // main cardioid: q * (q + (x - 1/4)) <= y^2 / 4,
+    // where q = (x - 1/4)^2 + y^2
+    double xq = c_re - .25;
+    double q = xq * xq + y2;
+    if (q * (q + xq) < .25 * y2 - CULL_MARGIN)
+        return true;
+
+    // period-2 bulb: disk of radius 1/4 around -1
+    double xb = c_re + 1.;
+    return xb * xb + y2 < .0625 - CULL_MARGIN;
+}
+
+//
+// mandelCull --
+//
+// Returns the same count as mandel(), but skips the iterations for
+// points that are known to be inside the set.  Besides the analytic
+// cardioid/bulb test, it uses Brent-style cycle detection: the orbit
+// value is saved at steps 1, 2, 4, 8, ... and if the orbit returns to
+// the saved value exactly, it is periodic in float arithmetic and can
+// never escape.  That test is exact, so no approximation is involved.
+static inline int mandelCull(float c_re, float c_im, int count)
+{
+    if (inMainCardioidOrBulb(c_re, c_im))
+        return count;
+
+    float z_re = c_re, z_im = c_im;
+    float saved_re = z_re, saved_im = z_im;
+    int period = 1, steps = 0;
+    int i;
+    for (i = 0; i < count; ++i) {
+
+        if (z_re * z_re + z_im * z_im > 4.f)
+            break;
+
+        float new_re = z_re*z_re - z_im*z_im;
+        float new_im = 2.f * z_re * z_im;
+        z_re = c_re + new_re;
+        z_im = c_im + new_im;
+
+        if (z_re == saved_re && z_im == saved_im)
+            return count;
+
+        if (++steps == period) {
+            saved_re = z_re;
+            saved_im = z_im;
+            steps = 0;
+            period *= 2;
+        }
+    }
+
+    return i;
+}
+
 //
 // MandelbrotSerial --
 //
@@ -67,12 +137,14 @@ static inline int mandel(float c_re, float c_im, int count)
 //   into the image viewport.
 // * width, height describe the size of the output image
 // * startRow, totalRows describe how much of the image to compute
+// * output may be int, uint16_t or uint8_t; it must hold maxIterations
+template <typename T>
 void mandelbrotSerial(
     float x0, float y0, float x1, float y1,
     int width, int height,
     int startRow, int totalRows,
     int maxIterations,
-    int output[])
+    T output[])
 {
     float dx = (x1 - x0) / width;
     float dy = (y1 - y0) / height;
@@ -90,23 +162,110 @@ void mandelbrotSerial(
     }
 }
 
-void myMandelbrotSerial(
+//
+// MandelbrotSerialTile --
+//
+// Same as mandelbrotSerial(), but only computes the numRows x numCols
+// block of the image starting at (startRow, startCol).  Pixels get the
+// same coordinates they would in a full-image call, so tiled renders
+// match mandelbrotSerial() exactly.  The Cull variant uses mandelCull().
+template <bool Cull, typename T>
+static void mandelbrotSerialTileImpl(
     float x0, float y0, float x1, float y1,
     int width, int height,
-    int modulus, int nthreads,
+    int startRow, int numRows,
+    int startCol, int numCols,
     int maxIterations,
-    int output[])
+    T output[])
 {
     float dx = (x1 - x0) / width;
     float dy = (y1 - y0) / height;
 
-    for (int j = modulus; j < height; j += nthreads) {
-        for (int i = 0; i < width; ++i) {
+    int endRow = startRow + numRows;
+    int endCol = startCol + numCols;
+
+    for (int j = startRow; j < endRow; j++) {
+        for (int i = startCol; i < endCol; ++i) {
             float x = x0 + i * dx;
             float y = y0 + j * dy;
 
             int index = (j * width + i);
-            output[index] = mandel(x, y, maxIterations);
+            output[index] = Cull ? mandelCull(x, y, maxIterations)
+                                 : mandel(x, y, maxIterations);
         }
     }
-}
\ No newline at end of file
+}
+
+template <typename T>
+void mandelbrotSerialTile(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[])
+{
+    mandelbrotSerialTileImpl<false>(x0, y0, x1, y1, width, height,
+                                    startRow, numRows, startCol, numCols,
+                                    maxIterations, output);
+}
+
+template <typename T>
+void mandelbrotSerialTileCull(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    T output[])
+{
+    mandelbrotSerialTileImpl<true>(x0, y0, x1, y1, width, height,
+                                   startRow, numRows, startCol, numCols,
+                                   maxIterations, output);
+}
+
+#define INSTANTIATE_SERIAL(T)                                           \
+    template void mandelbrotSerial<T>(float, float, float, float,       \
+                                      int, int, int, int, int, T[]);    \
+    template void mandelbrotSerialTile<T>(float, float, float, float,   \
+                                          int, int, int, int, int, int, \
+                                          int, T[]);                    \
+    template void mandelbrotSerialTileCull<T>(float, float, float, float, \
+                                              int, int, int, int, int, int, \
+                                              int, T[]);
+
+INSTANTIATE_SERIAL(int)
+INSTANTIATE_SERIAL(uint16_t)
+INSTANTIATE_SERIAL(uint8_t)
+
+//
+// MandelbrotSerialPoints --
+//
+// Scalar version of the point-list kernels: output[k] is the count of
+// the point (xs[k], ys[k]).
+template <bool Cull>
+static void mandelbrotSerialPointsImpl(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[])
+{
+    for (int k = 0; k < numPoints; k++)
+        output[k] = Cull ? mandelCull(xs[k], ys[k], maxIterations)
+                         : mandel(xs[k], ys[k], maxIterations);
+}
+
+void mandelbrotSerialPoints(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[])
+{
+    mandelbrotSerialPointsImpl<false>(xs, ys, numPoints, maxIterations, output);
+}
+
+void mandelbrotSerialPointsCull(
+    const float xs[], const float ys[], int numPoints,
+    int maxIterations,
+    int output[])
+{
+    mandelbrotSerialPointsImpl<true>(xs, ys, numPoints, maxIterations, output);
+}
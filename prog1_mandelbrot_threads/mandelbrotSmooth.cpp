@@ -0,0 +1,409 @@
+// GCC 12 reports the undefined source vector that the unmasked AVX-512
+// intrinsics pass internally as maybe-uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mandelbrot.h"
+#include "threadPool.h"
+
+/*
+  Smooth (continuous) escape time.
+
+  Instead of the integer count n, each pixel gets
+
+      nu = n + 2 - log2(log2(|z_n|^2))
+
+  where z_n is the first orbit value outside the radius 2 bailout.  nu
+  varies continuously across the bands of equal n, so colorings based on
+  it have no visible steps.  The output is nu / maxIterations, clamped to
+  [0, 1); points that never escape get exactly 1.
+
+  The log2 calls would cost more than the iterations of most pixels, so
+  the kernels use fastLog2(): the float exponent is taken from the bits,
+  and the log of the mantissa, reduced to [sqrt(1/2), sqrt(2)), comes
+  from the series 2 atanh(t) = ln((1 + t) / (1 - t)) up to t^7.  That is
+  accurate to about 1e-7 and needs only multiplies, adds and one divide,
+  so it vectorizes directly.  mandelbrotSmoothReference() uses libm to
+  check the kernels.
+ */
+
+static const float LOG2_E = 1.44269504f;
+static const float SQRT_2 = 1.41421356f;
+// largest float below 1
+static const float BELOW_ONE = 0.99999994f;
+
+// 2 (t + t^3/3 + t^5/5 + t^7/7) * log2(e)
+static const float C1 = 2.f * LOG2_E;
+static const float C3 = 2.f / 3.f * LOG2_E;
+static const float C5 = 2.f / 5.f * LOG2_E;
+static const float C7 = 2.f / 7.f * LOG2_E;
+
+//
+// fastLog2 --
+//
+// log2(x) for positive, normal x.
+static inline float fastLog2(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    float e = (float)((int)(bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+
+    if (m > SQRT_2) {
+        m *= .5f;
+        e += 1.f;
+    }
+
+    float t = (m - 1.f) / (m + 1.f);
+    float t2 = t * t;
+    return e + t * (C1 + t2 * (C3 + t2 * (C5 + t2 * C7)));
+}
+
+static inline float smoothValue(int count, float mag, int maxIterations) {
+    if (count >= maxIterations)
+        return 1.f;
+    float nu = count + 2.f - fastLog2(fastLog2(mag));
+    return fminf(fmaxf(nu / maxIterations, 0.f), BELOW_ONE);
+}
+
+//
+// mandelbrotSmoothTileScalar --
+//
+// Same iteration as mandel(), keeping |z|^2 at the escape.
+static void mandelbrotSmoothTileScalar(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    float output[])
+{
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    for (int j = startRow; j < startRow + numRows; j++) {
+        for (int i = startCol; i < startCol + numCols; ++i) {
+            float c_re = x0 + i * dx;
+            float c_im = y0 + j * dy;
+
+            float z_re = c_re, z_im = c_im;
+            float mag = 0.f;
+            int k;
+            for (k = 0; k < maxIterations; ++k) {
+                mag = z_re * z_re + z_im * z_im;
+                if (mag > 4.f)
+                    break;
+
+                float new_re = z_re*z_re - z_im*z_im;
+                float new_im = 2.f * z_re * z_im;
+                z_re = c_re + new_re;
+                z_im = c_im + new_im;
+            }
+
+            output[j * width + i] = smoothValue(k, mag, maxIterations);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastLog2AVX2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23),
+                                                   _mm256_set1_epi32(127)));
+    __m256 m = _mm256_castsi256_ps(
+        _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                        _mm256_set1_epi32(0x3f800000)));
+
+    __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(SQRT_2), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(.5f)), big);
+    e = _mm256_add_ps(e, _mm256_and_ps(big, _mm256_set1_ps(1.f)));
+
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_add_ps(_mm256_set1_ps(C5), _mm256_mul_ps(t2, _mm256_set1_ps(C7)));
+    p = _mm256_add_ps(_mm256_set1_ps(C3), _mm256_mul_ps(t2, p));
+    p = _mm256_add_ps(_mm256_set1_ps(C1), _mm256_mul_ps(t2, p));
+    return _mm256_add_ps(e, _mm256_mul_ps(t, p));
+}
+
+__attribute__((target("avx2")))
+static void mandelbrotSmoothTileAVX2(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    float output[])
+{
+    // 256 / sizeof(float) == 8
+    const int VECTOR_WIDTH = 8;
+
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    int endRow = startRow + numRows;
+    int endCol = startCol + numCols;
+
+    const __m256 four = _mm256_set1_ps(4.f);
+    const __m256 two = _mm256_set1_ps(2.f);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int j = startRow; j < endRow; j++) {
+        __m256 c_im = _mm256_set1_ps(y0 + j * dy);
+
+        for (int i = startCol; i < endCol; i += VECTOR_WIDTH) {
+            __m256i ii = _mm256_add_epi32(_mm256_set1_epi32(i), laneIndex);
+            __m256 c_re = _mm256_add_ps(_mm256_set1_ps(x0),
+                                        _mm256_mul_ps(_mm256_cvtepi32_ps(ii),
+                                                      _mm256_set1_ps(dx)));
+
+            __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(endCol), ii);
+            __m256 active = _mm256_castsi256_ps(valid);
+
+            __m256 z_re = c_re, z_im = c_im;
+            __m256i count = _mm256_setzero_si256();
+            // |z|^2 at the escape; 16 keeps the log finite in unused lanes
+            __m256 escapeMag = _mm256_set1_ps(16.f);
+
+            for (int k = 0; k < maxIterations; ++k) {
+                __m256 re2 = _mm256_mul_ps(z_re, z_re);
+                __m256 im2 = _mm256_mul_ps(z_im, z_im);
+                __m256 mag = _mm256_add_ps(re2, im2);
+
+                __m256 stillIn = _mm256_and_ps(active, _mm256_cmp_ps(mag, four, _CMP_NGT_UQ));
+                escapeMag = _mm256_blendv_ps(escapeMag, mag, _mm256_andnot_ps(stillIn, active));
+                active = stillIn;
+                if (_mm256_testz_ps(active, active))
+                    break;
+
+                count = _mm256_sub_epi32(count, _mm256_castps_si256(active));
+
+                __m256 new_re = _mm256_sub_ps(re2, im2);
+                __m256 new_im = _mm256_mul_ps(_mm256_mul_ps(two, z_re), z_im);
+                z_re = _mm256_add_ps(c_re, new_re);
+                z_im = _mm256_add_ps(c_im, new_im);
+            }
+
+            // nu = n + 2 - log2(log2(|z|^2)), normalized and clamped
+            __m256 nu = _mm256_sub_ps(
+                _mm256_add_ps(_mm256_cvtepi32_ps(count), two),
+                fastLog2AVX2(fastLog2AVX2(escapeMag)));
+            __m256 value = _mm256_min_ps(
+                _mm256_max_ps(_mm256_div_ps(nu, _mm256_set1_ps((float)maxIterations)),
+                              _mm256_setzero_ps()),
+                _mm256_set1_ps(BELOW_ONE));
+            __m256 interior = _mm256_castsi256_ps(
+                _mm256_cmpeq_epi32(count, _mm256_set1_epi32(maxIterations)));
+            value = _mm256_blendv_ps(value, _mm256_set1_ps(1.f), interior);
+
+            _mm256_maskstore_ps(output + j * width + i, valid, value);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 fastLog2AVX512(__m512 x) {
+    __m512i bits = _mm512_castps_si512(x);
+    __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23),
+                                                   _mm512_set1_epi32(127)));
+    __m512 m = _mm512_castsi512_ps(
+        _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)),
+                        _mm512_set1_epi32(0x3f800000)));
+
+    __mmask16 big = _mm512_cmp_ps_mask(m, _mm512_set1_ps(SQRT_2), _CMP_GT_OQ);
+    m = _mm512_mask_mul_ps(m, big, m, _mm512_set1_ps(.5f));
+    e = _mm512_mask_add_ps(e, big, e, _mm512_set1_ps(1.f));
+
+    __m512 one = _mm512_set1_ps(1.f);
+    __m512 t = _mm512_div_ps(_mm512_sub_ps(m, one), _mm512_add_ps(m, one));
+    __m512 t2 = _mm512_mul_ps(t, t);
+    __m512 p = _mm512_add_ps(_mm512_set1_ps(C5), _mm512_mul_ps(t2, _mm512_set1_ps(C7)));
+    p = _mm512_add_ps(_mm512_set1_ps(C3), _mm512_mul_ps(t2, p));
+    p = _mm512_add_ps(_mm512_set1_ps(C1), _mm512_mul_ps(t2, p));
+    return _mm512_add_ps(e, _mm512_mul_ps(t, p));
+}
+
+__attribute__((target("avx512f")))
+static void mandelbrotSmoothTileAVX512(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int startRow, int numRows,
+    int startCol, int numCols,
+    int maxIterations,
+    float output[])
+{
+    // 512 / sizeof(float) == 16
+    const int VECTOR_WIDTH = 16;
+
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    int endRow = startRow + numRows;
+    int endCol = startCol + numCols;
+
+    const __m512 four = _mm512_set1_ps(4.f);
+    const __m512 two = _mm512_set1_ps(2.f);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i laneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512 laneOffset = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7,
+                                             8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (int j = startRow; j < endRow; j++) {
+        __m512 c_im = _mm512_set1_ps(y0 + j * dy);
+
+        for (int i = startCol; i < endCol; i += VECTOR_WIDTH) {
+            __m512i ii = _mm512_add_epi32(_mm512_set1_epi32(i), laneIndex);
+            __m512 fi = _mm512_add_ps(_mm512_set1_ps((float)i), laneOffset);
+            __m512 c_re = _mm512_add_ps(_mm512_set1_ps(x0),
+                                        _mm512_mul_ps(fi, _mm512_set1_ps(dx)));
+
+            __mmask16 valid = _mm512_cmpgt_epi32_mask(_mm512_set1_epi32(endCol), ii);
+            __mmask16 active = valid;
+
+            __m512 z_re = c_re, z_im = c_im;
+            __m512i count = _mm512_setzero_si512();
+            __m512 escapeMag = _mm512_set1_ps(16.f);
+
+            for (int k = 0; k < maxIterations; ++k) {
+                __m512 re2 = _mm512_mul_ps(z_re, z_re);
+                __m512 im2 = _mm512_mul_ps(z_im, z_im);
+                __m512 mag = _mm512_add_ps(re2, im2);
+
+                __mmask16 stillIn = _mm512_mask_cmp_ps_mask(active, mag, four, _CMP_NGT_UQ);
+                escapeMag = _mm512_mask_mov_ps(escapeMag, active & ~stillIn, mag);
+                active = stillIn;
+                if (active == 0)
+                    break;
+
+                count = _mm512_mask_add_epi32(count, active, count, one);
+
+                __m512 new_re = _mm512_sub_ps(re2, im2);
+                __m512 new_im = _mm512_mul_ps(_mm512_mul_ps(two, z_re), z_im);
+                z_re = _mm512_add_ps(c_re, new_re);
+                z_im = _mm512_add_ps(c_im, new_im);
+            }
+
+            __m512 nu = _mm512_sub_ps(
+                _mm512_add_ps(_mm512_cvtepi32_ps(count), two),
+                fastLog2AVX512(fastLog2AVX512(escapeMag)));
+            __m512 value = _mm512_min_ps(
+                _mm512_max_ps(_mm512_div_ps(nu, _mm512_set1_ps((float)maxIterations)),
+                              _mm512_setzero_ps()),
+                _mm512_set1_ps(BELOW_ONE));
+            __mmask16 interior = _mm512_cmpeq_epi32_mask(count, _mm512_set1_epi32(maxIterations));
+            value = _mm512_mask_mov_ps(value, interior, _mm512_set1_ps(1.f));
+
+            _mm512_mask_storeu_ps(output + j * width + i, valid, value);
+        }
+    }
+}
+
+typedef struct {
+    float x0, x1;
+    float y0, y1;
+    int width;
+    int height;
+    int maxIterations;
+    float* output;
+    MandelTileFuncT<float> tileFunc;
+} SmoothArgs;
+
+static void smoothRowTask(void *data, int threadIndex, int threadCount,
+                          int taskIndex, int taskCount) {
+    const SmoothArgs * const args = (const SmoothArgs *)data;
+
+    args->tileFunc(args->x0, args->y0, args->x1, args->y1,
+                   args->width, args->height, taskIndex, 1, 0, args->width,
+                   args->maxIterations, args->output);
+}
+
+//
+// MandelbrotSmooth --
+//
+// Renders the normalized smooth escape time of every pixel (see above)
+// on the thread pool, one row per task, with the kernel selected by
+// options.  Interior culling does not apply: culled points would get 1
+// either way.
+void mandelbrotSmooth(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    float output[],
+    const MandelOptions &options)
+{
+    SmoothArgs args;
+    args.x0 = x0;
+    args.y0 = y0;
+    args.x1 = x1;
+    args.y1 = y1;
+    args.width = width;
+    args.height = height;
+    args.maxIterations = maxIterations;
+    args.output = output;
+
+    switch (resolveMandelKernel(options.kernel)) {
+    case KERNEL_AVX2:
+        args.tileFunc = mandelbrotSmoothTileAVX2;
+        break;
+    case KERNEL_AVX512:
+        args.tileFunc = mandelbrotSmoothTileAVX512;
+        break;
+    default:
+        args.tileFunc = mandelbrotSmoothTileScalar;
+        break;
+    }
+
+    getThreadPool(numThreads)->run(smoothRowTask, &args, height);
+}
+
+//
+// MandelbrotSmoothReference --
+//
+// Serial mandelbrotSmooth() with libm's log2, to check the kernels.
+void mandelbrotSmoothReference(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    float output[])
+{
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; ++i) {
+            float c_re = x0 + i * dx;
+            float c_im = y0 + j * dy;
+
+            float z_re = c_re, z_im = c_im;
+            float mag = 0.f;
+            int k;
+            for (k = 0; k < maxIterations; ++k) {
+                mag = z_re * z_re + z_im * z_im;
+                if (mag > 4.f)
+                    break;
+
+                float new_re = z_re*z_re - z_im*z_im;
+                float new_im = 2.f * z_re * z_im;
+                z_re = c_re + new_re;
+                z_im = c_im + new_im;
+            }
+
+            float value = 1.f;
+            if (k < maxIterations) {
+                double nu = k + 2. - log2(log2((double)mag));
+                value = fminf(fmaxf((float)(nu / maxIterations), 0.f), BELOW_ONE);
+            }
+            output[j * width + i] = value;
+        }
+    }
+}
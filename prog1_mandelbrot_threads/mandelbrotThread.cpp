@@ -1,104 +1,232 @@
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
 #include <thread>
+#include <vector>
 
 #include "CycleTimer.h"
+#include "mandelbrot.h"
+#include "threadPool.h"
 
-typedef struct {
+template <typename T>
+struct WorkerArgs {
     float x0, x1;
     float y0, y1;
     unsigned int width;
     unsigned int height;
     int maxIterations;
-    int* output;
-    int threadId;
-    int numThreads;
-} WorkerArgs;
+    T* output;
+    MandelTileFuncT<T> tileFunc;
 
+    // Tile schedules: tiles are numbered in raster order and handed out
+    // through nextTile.  tileOrder, if set, permutes that order.
+    int tileWidth, tileHeight;
+    int tilesX, numTiles;
+    const int *tileOrder;
+    std::atomic<int> nextTile;
 
-extern void mandelbrotSerial(
-    float x0, float y0, float x1, float y1,
-    int width, int height,
-    int startRow, int numRows,
-    int maxIterations,
-    int output[]);
+    // Per-thread busy time, indexed by pool thread index (may be NULL).
+    double *busySeconds;
+};
 
-extern void myMandelbrotSerial(
-    float x0, float y0, float x1, float y1,
-    int width, int height,
-    int modulus, int nthreads,
-    int maxIterations,
-    int output[]);
+
+// Downsampling factor of the cost prediction pre-pass in each dimension.
+static const int COST_PREPASS_FACTOR = 8;
+
+//
+// workerRowTask --
+//
+// Pool task entrypoint for SCHEDULE_ROWS.  Each task computes one row of
+// the output image; the pool's work stealing balances rows of very
+// different cost across the workers.
+template <typename T>
+static void workerRowTask(void *data, int threadIndex, int threadCount,
+                          int taskIndex, int taskCount) {
+    WorkerArgs<T> * const args = (WorkerArgs<T> *)data;
+
+    double startTime = CycleTimer::currentSeconds();
+    args->tileFunc(args->x0, args->y0, args->x1, args->y1,
+                   args->width, args->height, taskIndex, 1, 0, args->width,
+                   args->maxIterations, args->output);
+    if (args->busySeconds)
+        args->busySeconds[threadIndex] += CycleTimer::currentSeconds() - startTime;
+}
+
+//
+// workerTileTask --
+//
+// Pool task entrypoint for the tile schedules.  One task runs per
+// thread and keeps claiming tiles from the shared counter until none are
+// left, so no thread goes idle while there is still work.
+template <typename T>
+static void workerTileTask(void *data, int threadIndex, int threadCount,
+                           int taskIndex, int taskCount) {
+    WorkerArgs<T> * const args = (WorkerArgs<T> *)data;
+
+    while (1) {
+        int next = args->nextTile.fetch_add(1);
+        if (next >= args->numTiles)
+            break;
+
+        int tile = args->tileOrder ? args->tileOrder[next] : next;
+        int startRow = (tile / args->tilesX) * args->tileHeight;
+        int startCol = (tile % args->tilesX) * args->tileWidth;
+        int numRows = std::min(args->tileHeight, (int)args->height - startRow);
+        int numCols = std::min(args->tileWidth, (int)args->width - startCol);
+
+        double startTime = CycleTimer::currentSeconds();
+        args->tileFunc(args->x0, args->y0, args->x1, args->y1,
+                       args->width, args->height,
+                       startRow, numRows, startCol, numCols,
+                       args->maxIterations, args->output);
+        if (args->busySeconds)
+            args->busySeconds[threadIndex] += CycleTimer::currentSeconds() - startTime;
+    }
+}
 
 //
-// workerThreadStart --
+// predictTileOrder --
 //
-// Thread entrypoint.
-void workerThreadStart(WorkerArgs * const args) {
-
-    // TODO FOR CS149 STUDENTS: Implement the body of the worker
-    // thread here. Each thread should make a call to mandelbrotSerial()
-    // to compute a part of the output image.  For example, in a
-    // program that uses two threads, thread 0 could compute the top
-    // half of the image and thread 1 could compute the bottom half.
-
-    myMandelbrotSerial(args->x0, args->y0, args->x1, args->y1, args->width,
-                     args->height, args->threadId, args->numThreads,
-                     args->maxIterations, args->output);
+// Renders the viewport at 1/COST_PREPASS_FACTOR resolution and uses the
+// iteration counts as an estimate of the cost of each tile.  Returns the
+// tiles sorted by decreasing predicted cost, so the most expensive tiles
+// are started first and the cheap ones fill in the gaps at the end.
+// The pre-pass always renders int counts with tileFunc.
+template <typename T>
+static std::vector<int> predictTileOrder(ThreadPool *pool, const WorkerArgs<T> &args,
+                                         MandelTileFunc tileFunc) {
+    int lowWidth = (args.width + COST_PREPASS_FACTOR - 1) / COST_PREPASS_FACTOR;
+    int lowHeight = (args.height + COST_PREPASS_FACTOR - 1) / COST_PREPASS_FACTOR;
+    std::vector<int> lowRes(lowWidth * lowHeight);
+
+    WorkerArgs<int> lowArgs;
+    lowArgs.x0 = args.x0;
+    lowArgs.y0 = args.y0;
+    lowArgs.x1 = args.x1;
+    lowArgs.y1 = args.y1;
+    lowArgs.width = lowWidth;
+    lowArgs.height = lowHeight;
+    lowArgs.maxIterations = args.maxIterations;
+    lowArgs.output = lowRes.data();
+    lowArgs.tileFunc = tileFunc;
+    lowArgs.busySeconds = args.busySeconds;
+    pool->run(workerRowTask<int>, &lowArgs, lowHeight);
+
+    // Each sample stands in for the block of full resolution pixels it
+    // was taken from; +1 accounts for the per-pixel overhead.
+    std::vector<long long> cost(args.numTiles, 0);
+    for (int j = 0; j < lowHeight; j++) {
+        int tileRow = (j * (int)args.height / lowHeight) / args.tileHeight;
+        for (int i = 0; i < lowWidth; i++) {
+            int tileCol = (i * (int)args.width / lowWidth) / args.tileWidth;
+            cost[tileRow * args.tilesX + tileCol] += lowRes[j * lowWidth + i] + 1;
+        }
+    }
+
+    std::vector<int> order(args.numTiles);
+    for (int t = 0; t < args.numTiles; t++)
+        order[t] = t;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return cost[a] > cost[b]; });
+    return order;
+}
+
+//
+// getThreadPool --
+//
+// Returns a pool with numThreads workers.  The pool persists across
+// calls so that rendering a sequence of frames only creates threads
+// once; it is rebuilt only if the requested thread count changes.
+ThreadPool *getThreadPool(int numThreads) {
+    static ThreadPool *pool = NULL;
+
+    if (pool == NULL || pool->getNumThreads() != numThreads) {
+        delete pool;
+        pool = new ThreadPool(numThreads);
+    }
+    return pool;
 }
 
 //
 // MandelbrotThread --
 //
 // Multi-threaded implementation of mandelbrot set image generation.
-// Threads of execution are created by spawning std::threads.
+// The image is split into rows or 2D tiles (see MandelSchedule) that
+// run on a persistent work-stealing thread pool.  If stats is non-NULL
+// it receives the time each thread spent computing.  output may be int,
+// uint16_t or uint8_t, as long as it can hold maxIterations.
+template <typename T>
 void mandelbrotThread(
     int numThreads,
     float x0, float y0, float x1, float y1,
     int width, int height,
-    int maxIterations, int output[])
+    int maxIterations, T output[],
+    const MandelOptions &options,
+    MandelThreadStats *stats)
 {
-    static constexpr int MAX_THREADS = 32;
+    if (numThreads < 1)
+    {
+        fprintf(stderr, "Error: Need at least one thread\n");
+        exit(1);
+    }
 
-    if (numThreads > MAX_THREADS)
+    if (options.tileWidth < 1 || options.tileHeight < 1)
     {
-        fprintf(stderr, "Error: Max allowed threads is %d\n", MAX_THREADS);
+        fprintf(stderr, "Error: Tile size must be at least 1x1\n");
         exit(1);
     }
 
-    // Creates thread objects that do not yet represent a thread.
-    std::thread workers[MAX_THREADS];
-    WorkerArgs args[MAX_THREADS];
-
-    for (int i=0; i<numThreads; i++) {
-      
-        // TODO FOR CS149 STUDENTS: You may or may not wish to modify
-        // the per-thread arguments here.  The code below copies the
-        // same arguments for each thread
-        args[i].x0 = x0;
-        args[i].y0 = y0;
-        args[i].x1 = x1;
-        args[i].y1 = y1;
-        args[i].width = width;
-        args[i].height = height;
-        args[i].maxIterations = maxIterations;
-        args[i].numThreads = numThreads;
-        args[i].output = output;
-      
-        args[i].threadId = i;
+    ThreadPool *pool = getThreadPool(numThreads);
+
+    WorkerArgs<T> args;
+    args.x0 = x0;
+    args.y0 = y0;
+    args.x1 = x1;
+    args.y1 = y1;
+    args.width = width;
+    args.height = height;
+    args.maxIterations = maxIterations;
+    args.output = output;
+    args.tileFunc = getMandelTileFuncT<T>(options.kernel, options.cullInterior);
+    args.busySeconds = NULL;
+
+    if (stats) {
+        stats->busySeconds.assign(pool->getNumThreads(), 0.0);
+        args.busySeconds = stats->busySeconds.data();
     }
 
-    // Spawn the worker threads.  Note that only numThreads-1 std::threads
-    // are created and the main application thread is used as a worker
-    // as well.
-    for (int i=1; i<numThreads; i++) {
-        workers[i] = std::thread(workerThreadStart, &args[i]);
+    if (options.schedule == SCHEDULE_ROWS) {
+        if (stats)
+            stats->numTasks = height;
+        pool->run(workerRowTask<T>, &args, height);
+        return;
     }
-    
-    workerThreadStart(&args[0]);
 
-    // join worker threads
-    for (int i=1; i<numThreads; i++) {
-        workers[i].join();
+    args.tileWidth = options.tileWidth;
+    args.tileHeight = options.tileHeight;
+    args.tilesX = (width + options.tileWidth - 1) / options.tileWidth;
+    args.numTiles = args.tilesX * ((height + options.tileHeight - 1) / options.tileHeight);
+    args.tileOrder = NULL;
+    args.nextTile = 0;
+
+    std::vector<int> order;
+    if (options.schedule == SCHEDULE_COST) {
+        order = predictTileOrder(pool, args,
+                                 getMandelTileFunc(options.kernel, options.cullInterior));
+        args.tileOrder = order.data();
     }
+
+    if (stats)
+        stats->numTasks = args.numTiles;
+    pool->run(workerTileTask<T>, &args, pool->getNumThreads());
 }
 
+#define INSTANTIATE_THREAD(T)                                           \
+    template void mandelbrotThread<T>(int, float, float, float, float,  \
+                                      int, int, int, T[],               \
+                                      const MandelOptions &,            \
+                                      MandelThreadStats *);
+
+INSTANTIATE_THREAD(int)
+INSTANTIATE_THREAD(uint16_t)
+INSTANTIATE_THREAD(uint8_t)
@@ -0,0 +1,138 @@
+#include "threadPool.h"
+
+// Index of the pool worker running on this thread.  Threads that are not
+// pool workers (i.e. the application thread) act as worker 0.
+static thread_local int tlsThreadIndex = 0;
+
+ThreadPool::ThreadPool(int numThreads)
+    : numThreads(numThreads < 1 ? 1 : numThreads),
+      numQueued(0), shuttingDown(false)
+{
+    queues = new WorkerQueue[this->numThreads];
+
+    // Worker 0 is the thread that calls sync(), so only numThreads-1
+    // std::threads are created.
+    for (int i = 1; i < this->numThreads; i++)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        shuttingDown = true;
+    }
+    wakeCond.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    delete[] queues;
+}
+
+void
+ThreadPool::launch(PoolTaskFunc func, void *data, int taskCount, PoolBatch *batch) {
+    if (taskCount <= 0)
+        return;
+
+    batch->numUnfinished += taskCount;
+
+    // Deal the tasks out round-robin so every worker starts with a share
+    // of its own; stealing evens out whatever imbalance remains.
+    for (int q = 0; q < numThreads && q < taskCount; q++) {
+        std::lock_guard<std::mutex> guard(queues[q].lock);
+        for (int i = q; i < taskCount; i += numThreads) {
+            PoolTask task = { func, data, i, taskCount, batch };
+            queues[q].tasks.push_back(task);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        numQueued += taskCount;
+    }
+    wakeCond.notify_all();
+}
+
+void
+ThreadPool::sync(PoolBatch *batch) {
+    int threadIndex = tlsThreadIndex;
+    PoolTask task;
+
+    while (batch->numUnfinished.load() > 0) {
+        if (popOrSteal(threadIndex, &task)) {
+            runTask(threadIndex, task);
+            continue;
+        }
+
+        // Nothing left to steal: the remaining tasks of this batch are
+        // running on other workers.  Sleep until they finish or more work
+        // shows up.
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wakeCond.wait(guard, [&] {
+            return batch->numUnfinished.load() == 0 || numQueued.load() > 0;
+        });
+    }
+}
+
+void
+ThreadPool::run(PoolTaskFunc func, void *data, int taskCount) {
+    PoolBatch batch;
+    launch(func, data, taskCount, &batch);
+    sync(&batch);
+}
+
+bool
+ThreadPool::popOrSteal(int threadIndex, PoolTask *task) {
+    for (int i = 0; i < numThreads; i++) {
+        int victim = (threadIndex + i) % numThreads;
+        WorkerQueue &q = queues[victim];
+
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty())
+            continue;
+
+        // The owner works LIFO on its own deque; thieves take from the
+        // opposite end.
+        if (victim == threadIndex) {
+            *task = q.tasks.back();
+            q.tasks.pop_back();
+        } else {
+            *task = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        numQueued--;
+        return true;
+    }
+    return false;
+}
+
+void
+ThreadPool::runTask(int threadIndex, const PoolTask &task) {
+    task.func(task.data, threadIndex, numThreads, task.taskIndex, task.taskCount);
+
+    if (--task.batch->numUnfinished == 0) {
+        // Wake the thread waiting in sync() on this batch.
+        std::lock_guard<std::mutex> guard(sleepLock);
+        wakeCond.notify_all();
+    }
+}
+
+void
+ThreadPool::workerLoop(int threadIndex) {
+    tlsThreadIndex = threadIndex;
+    PoolTask task;
+
+    while (1) {
+        if (popOrSteal(threadIndex, &task)) {
+            runTask(threadIndex, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wakeCond.wait(guard, [&] {
+            return shuttingDown || numQueued.load() > 0;
+        });
+        if (shuttingDown)
+            return;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Signature of functions run by the pool.  Mirrors the ispc task
+// entrypoint in common/tasksys.cpp so kernels look the same in both
+// programs.
+typedef void (*PoolTaskFunc)(void *data, int threadIndex, int threadCount,
+                             int taskIndex, int taskCount);
+
+struct PoolTask {
+    PoolTaskFunc func;
+    void *data;
+    int taskIndex, taskCount;
+    struct PoolBatch *batch;
+};
+
+// A set of tasks submitted by one launch().  sync() waits until all of
+// them have finished.
+struct PoolBatch {
+    std::atomic<int> numUnfinished;
+
+    PoolBatch() : numUnfinished(0) {}
+};
+
+/** ThreadPool keeps numThreads-1 worker threads alive across calls so
+    that a frame does not pay for thread creation.  Every worker owns a
+    deque of tasks: it pops from the back of its own deque and, when that
+    runs dry, steals from the front of the other workers' deques.  The
+    thread calling sync() acts as worker 0 while it waits.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    int getNumThreads() const { return numThreads; }
+
+    // Queue taskCount tasks without waiting for them.
+    void launch(PoolTaskFunc func, void *data, int taskCount, PoolBatch *batch);
+
+    // Run tasks from the pool until every task of batch has finished.
+    void sync(PoolBatch *batch);
+
+    // launch() followed by sync().
+    void run(PoolTaskFunc func, void *data, int taskCount);
+
+private:
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<PoolTask> tasks;
+    };
+
+    bool popOrSteal(int threadIndex, PoolTask *task);
+    void runTask(int threadIndex, const PoolTask &task);
+    void workerLoop(int threadIndex);
+
+    int numThreads;
+    std::vector<std::thread> workers;
+    WorkerQueue *queues;
+
+    // Number of tasks sitting in any deque; idle workers sleep on
+    // wakeCond while it is zero.
+    std::atomic<int> numQueued;
+    std::mutex sleepLock;
+    std::condition_variable wakeCond;
+    bool shuttingDown;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "viewportCache.h"
+#include "threadPool.h"
+
+typedef struct {
+    int width;
+    int maxIterations;
+    MandelPointsFunc pointsFunc;
+    int* output;
+
+    // Sample coordinates of the new frame's columns and rows.
+    const float *xs, *ys;
+
+    // The previous frame, and for each row/column of the new frame the
+    // row/column of the previous frame sampling the same point, or -1.
+    const int *frame;
+    const int *oldRow, *oldCol;
+} CacheFillArgs;
+
+
+//
+// cacheFillTask --
+//
+// Pool task entrypoint: copies the pixels of one row that the previous
+// frame has, and runs the others through the point-list kernel.
+static void cacheFillTask(void *data, int threadIndex, int threadCount,
+                          int taskIndex, int taskCount) {
+    CacheFillArgs * const args = (CacheFillArgs *)data;
+
+    int j = taskIndex;
+    int width = args->width;
+    int *row = args->output + j * width;
+    std::vector<float> ys(width, args->ys[j]);
+
+    if (args->oldRow[j] < 0) {
+        args->pointsFunc(args->xs, ys.data(), width, args->maxIterations, row);
+        return;
+    }
+
+    const int *oldRow = args->frame + args->oldRow[j] * width;
+    std::vector<float> xs;
+    std::vector<int> cols;
+    for (int i = 0; i < width; i++) {
+        if (args->oldCol[i] >= 0) {
+            row[i] = oldRow[args->oldCol[i]];
+        } else {
+            xs.push_back(args->xs[i]);
+            cols.push_back(i);
+        }
+    }
+
+    int numMissing = (int)cols.size();
+    std::vector<int> counts(numMissing);
+    args->pointsFunc(xs.data(), ys.data(), numMissing, args->maxIterations, counts.data());
+    for (int k = 0; k < numMissing; k++)
+        row[cols[k]] = counts[k];
+}
+
+//
+// mapToOld --
+//
+// For the n samples coords[i] = (float)(start + i * step) of the new
+// frame, finds the sample of the previous frame (oldStart, oldStep,
+// oldCoords) with exactly the same coordinate.  Only the old sample
+// nearest in the plane can match.  Returns the number of samples found.
+static int mapToOld(double start, double step, const float coords[],
+                    double oldStart, double oldStep, const float oldCoords[],
+                    int n, int map[]) {
+    int found = 0;
+    for (int i = 0; i < n; i++) {
+        double k = floor((start + i * step - oldStart) / oldStep + .5);
+        map[i] = -1;
+        if (k >= 0 && k < n && oldCoords[(int)k] == coords[i]) {
+            map[i] = (int)k;
+            found++;
+        }
+    }
+    return found;
+}
+
+ViewportCache::ViewportCache(int width, int height, int maxIterations)
+    : width(width), height(height), maxIterations(maxIterations),
+      valid(false), cachedXs(width), cachedYs(height), frame(width * height)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+//
+// ViewportCache::render --
+//
+// Renders the viewport (x0, y0, dx, dy) into output on the thread pool,
+// with the point-list kernel selected by options.  Pixel (i, j) is the
+// point ((float)(x0 + i * dx), (float)(y0 + j * dy)); the mapping is
+// evaluated in double precision so that pans and zooms land on exactly
+// the same float coordinates as the previous frame.
+void
+ViewportCache::render(int numThreads, double x0, double y0, double dx, double dy,
+                      const MandelOptions &options, int output[]) {
+    std::vector<float> xs(width), ys(height);
+    for (int i = 0; i < width; i++)
+        xs[i] = (float)(x0 + i * dx);
+    for (int j = 0; j < height; j++)
+        ys[j] = (float)(y0 + j * dy);
+
+    std::vector<int> oldRow(height, -1), oldCol(width, -1);
+
+    long long reused = 0;
+    if (valid) {
+        int rows = mapToOld(y0, dy, ys.data(), cachedY0, cachedDy, cachedYs.data(),
+                            height, oldRow.data());
+        int cols = mapToOld(x0, dx, xs.data(), cachedX0, cachedDx, cachedXs.data(),
+                            width, oldCol.data());
+        reused = (long long)rows * cols;
+    }
+
+    CacheFillArgs args;
+    args.width = width;
+    args.maxIterations = maxIterations;
+    args.pointsFunc = getMandelPointsFunc(options.kernel, options.cullInterior);
+    args.output = output;
+    args.xs = xs.data();
+    args.ys = ys.data();
+    args.frame = frame.data();
+    args.oldRow = oldRow.data();
+    args.oldCol = oldCol.data();
+    getThreadPool(numThreads)->run(cacheFillTask, &args, height);
+
+    memcpy(frame.data(), output, width * height * sizeof(int));
+    valid = true;
+    cachedX0 = x0;
+    cachedY0 = y0;
+    cachedDx = dx;
+    cachedDy = dy;
+    cachedXs.swap(xs);
+    cachedYs.swap(ys);
+
+    stats.pixelsReused += reused;
+    stats.pixelsComputed += (long long)width * height - reused;
+    stats.framesReused += reused > 0;
+    stats.frames++;
+}
@@ -0,0 +1,48 @@
+#ifndef VIEWPORT_CACHE_H_
+#define VIEWPORT_CACHE_H_
+
+#include <vector>
+
+#include "mandelbrot.h"
+
+struct ViewportCacheStats {
+    long long pixelsReused;    // hits
+    long long pixelsComputed;  // misses
+    int framesReused;          // frames that reused at least one pixel
+    int frames;
+};
+
+/** ViewportCache renders a sequence of viewports, reusing the pixels of
+    the previous frame that sample the same point of the complex plane.
+
+    A viewport is the mapping pixel (i, j) -> (x0 + i * dx, y0 + j * dy).
+    A pixel is copied from the previous frame only if it samples exactly
+    the same float coordinates, as happens for pans by whole pixels and
+    for zooms by integer factors, so the output is identical to an
+    uncached render.  Only newly exposed strips or in-between samples are
+    iterated, through the vectorized point-list kernels.
+ */
+class ViewportCache {
+public:
+    ViewportCache(int width, int height, int maxIterations);
+
+    void render(int numThreads, double x0, double y0, double dx, double dy,
+                const MandelOptions &options, int output[]);
+
+    void invalidate() { valid = false; }
+    const ViewportCacheStats &getStats() const { return stats; }
+
+private:
+    int width, height;
+    int maxIterations;
+
+    bool valid;
+    double cachedX0, cachedY0, cachedDx, cachedDy;
+    // sample coordinates of the cached frame's columns and rows
+    std::vector<float> cachedXs, cachedYs;
+    std::vector<int> frame;
+
+    ViewportCacheStats stats;
+};
+
+#endif
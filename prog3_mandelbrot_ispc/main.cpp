@@ -1,9 +1,24 @@
 #include <stdio.h>
 #include <algorithm>
 #include <getopt.h>
+#include <math.h>
+#include <numeric>
+#include <string.h>
 
 #include "CycleTimer.h"
+#include "ispcTargets.h"
 #include "mandelbrot_ispc.h"
+#include "mandelbrot_fast_ispc.h"
+
+typedef void MandelISPCFunc(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    bool cullInterior,
+    int output[]);
+
+ISPC_DECLARE_TARGETS(MandelISPCFunc, mandelbrot_ispc);
+ISPC_DECLARE_TARGETS(IspcIsaFunc, mandelbrot_ispc_isa);
 
 extern void mandelbrotSerial(
     float x0, float y0, float x1, float y1,
@@ -19,20 +34,38 @@ extern void mandelbrotThread(
     int maxIterations,
     int output[]);
 
+extern void mandelbrotSmoothSerial(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    float output[]);
+
+extern void writeSmoothPPMImage(
+    float* data,
+    int width, int height,
+    const char *filename);
+
+extern void writeFloatPPMImage(
+    float* data,
+    int width, int height,
+    const char *filename,
+    int maxIterations);
+
 extern void writePPMImage(
     int* data,
     int width, int height,
     const char *filename,
     int maxIterations);
 
-bool verifyResult (int *gold, int *result, int width, int height) {
+template <typename T>
+bool verifyResult (int *gold, T *result, int width, int height) {
     int i, j;
 
     for (i = 0; i < height; i++) {
         for (j = 0; j < width; j++) {
             if (gold[i * width + j] != result[i * width + j]) {
                 printf ("Mismatch : [%d][%d], Expected : %d, Actual : %d\n",
-                            i, j, gold[i * width + j], result[i * width + j]);
+                            i, j, gold[i * width + j], (int)result[i * width + j]);
                 return 0;
             }
         }
@@ -41,6 +74,31 @@ bool verifyResult (int *gold, int *result, int width, int height) {
     return 1;
 }
 
+//
+// verifyResultTolerant --
+//
+// verifyResult() for kernels whose arithmetic differs from the serial
+// code's (FMA, fast math).  An orbit rounded differently usually escapes
+// an iteration early or late, which is accepted for up to maxOffByOne of
+// the pixels.  Near the boundary, though, the orbits can diverge and
+// escape many iterations apart; those pixels are bounded separately, by
+// the tighter maxOffByMore.  Reports both fractions.
+static bool
+verifyResultTolerant(int *gold, int *result, int width, int height,
+                     double maxOffByOne, double maxOffByMore) {
+    long long offByOne = 0, offByMore = 0;
+    for (int i = 0; i < width * height; i++) {
+        int diff = abs(gold[i] - result[i]);
+        offByOne += diff == 1;
+        offByMore += diff > 1;
+    }
+
+    double numPixels = (double)width * height;
+    printf("\t\t\t\t%.3f%% of pixels off by one iteration, %.3f%% by more\n",
+           100. * offByOne / numPixels, 100. * offByMore / numPixels);
+    return offByOne <= maxOffByOne * numPixels && offByMore <= maxOffByMore * numPixels;
+}
+
 void
 scaleAndShift(float& x0, float& x1, float& y0, float& y1,
               float scale,
@@ -65,15 +123,120 @@ void usage(const char* progname) {
     printf("Program Options:\n");
     printf("  -t  --tasks        Run ISPC code implementation with tasks\n");
     printf("  -v  --view <INT>   Use specified view settings\n");
+    printf("  -f  --fast         Also run the ISPC code built with FMA and fast math (inexact)\n");
+    printf("  -x  --targets      Also time the ISPC code compiled for each target this CPU supports\n");
+    printf("  -T  --tile <W>x<H> Also run the tasked ISPC code with WxH tiles, one per task\n");
+    printf("  -u  --tune         Also run it with the fastest tile shape found by timing several\n");
+    printf("  -c  --cull         Skip iterating points known to be inside the set\n");
+    printf("  -k  --compact      Also run the lane-compacting ISPC kernel and report lane utilization\n");
+    printf("  -s  --smooth       Also render smooth (fractional) escape times, colored\n");
+    printf("  -a  --aa <N>       Also render anti-aliased, refining edge pixels with NxN samples\n");
+    printf("  -i  --iters <N>    Use at most N iterations per pixel (default 256)\n");
     printf("  -?  --help         This message\n");
 }
 
 
+//
+// runCompactISPC --
+//
+// Runs the uint16_t or uint8_t variant of the ispc kernel (with tasks if
+// requested) and checks it against the serial output.  Returns the best
+// time, or a negative value if the output does not match.
+template <typename T, typename Kernel>
+double runCompactISPC(Kernel kernel, float x0, float y0, float x1, float y1,
+                      int width, int height, int maxIterations, bool cullInterior,
+                      int *gold) {
+    T *output = new T[width*height];
+
+    double minISPC = 1e30;
+    for (int i = 0; i < 3; ++i) {
+        memset(output, 0, width * height * sizeof(T));
+        double startTime = CycleTimer::currentSeconds();
+        kernel(x0, y0, x1, y1, width, height, maxIterations, cullInterior, output);
+        double endTime = CycleTimer::currentSeconds();
+        minISPC = std::min(minISPC, endTime - startTime);
+    }
+
+    bool ok = verifyResult(gold, output, width, height);
+    delete[] output;
+    return ok ? minISPC : -1;
+}
+
+//
+// timeTilesISPC --
+//
+// Best time of runs runs of mandelbrot_ispc_tiles with the given tile
+// shape.
+static double timeTilesISPC(float x0, float y0, float x1, float y1,
+                            int width, int height, int tileWidth, int tileHeight,
+                            int maxIterations, bool cullInterior, int *output, int runs) {
+    double minTime = 1e30;
+    for (int i = 0; i < runs; ++i) {
+        double startTime = CycleTimer::currentSeconds();
+        mandelbrot_ispc_tiles(x0, y0, x1, y1, width, height, tileWidth, tileHeight,
+                              maxIterations, cullInterior, output);
+        double endTime = CycleTimer::currentSeconds();
+        minTime = std::min(minTime, endTime - startTime);
+    }
+    return minTime;
+}
+
+//
+// foreachUtilization --
+//
+// Fraction of lane iterations doing useful work in the foreach kernels,
+// estimated from the iteration counts: every gang of gangWidth
+// consecutive pixels in a row iterates as long as its slowest lane.
+static double foreachUtilization(const int *counts, int width, int height, int gangWidth) {
+    long long useful = 0, executed = 0;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; i += gangWidth) {
+            int n = std::min(gangWidth, width - i);
+            const int *gang = counts + (size_t)j * width + i;
+            useful += std::accumulate(gang, gang + n, 0LL);
+            executed += (long long)gangWidth * *std::max_element(gang, gang + n);
+        }
+    }
+    return executed ? (double)useful / executed : 1.;
+}
+
+//
+// tuneTileShape --
+//
+// Times mandelbrot_ispc_tiles over a range of tile shapes, from full
+// width rows down to small squares, and returns the fastest in tileWidth
+// and tileHeight.  Task overhead and load balance both depend on the
+// machine and the view, so there is no single best granularity.
+static void tuneTileShape(float x0, float y0, float x1, float y1,
+                          int width, int height, int maxIterations, bool cullInterior,
+                          int *output, int &tileWidth, int &tileHeight) {
+    static const int widthDivisors[] = { 1, 2, 4, 8, 16 };
+    static const int tileHeights[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+    double bestTime = 1e30, worstTime = 0;
+    for (int d : widthDivisors) {
+        for (int h : tileHeights) {
+            int w = (width + d - 1) / d;
+            double t = timeTilesISPC(x0, y0, x1, y1, width, height, w, h,
+                                     maxIterations, cullInterior, output, 2);
+            if (t < bestTime) {
+                bestTime = t;
+                tileWidth = w;
+                tileHeight = h;
+            }
+            worstTime = std::max(worstTime, t);
+        }
+    }
+
+    printf("[tile tuning]:\t\t\tbest %dx%d tiles at [%.3f] ms, worst [%.3f] ms\n",
+           tileWidth, tileHeight, bestTime * 1000, worstTime * 1000);
+}
+
 int main(int argc, char** argv) {
 
     const unsigned int width = 1200;
     const unsigned int height = 800;
-    const int maxIterations = 256;
+    int maxIterations = 256;
 
     float x0 = -2;
     float x1 = 1;
@@ -81,22 +244,80 @@ int main(int argc, char** argv) {
     float y1 = 1;
 
     bool useTasks = false;
+    bool cullInterior = false;
+    bool useFast = false;
+    bool allTargets = false;
+    bool useCompact = false;
+    bool useSmooth = false;
+    int aaSamples = 0;
+    int tileWidth = 0, tileHeight = 0;
+    bool tuneTiles = false;
 
     // parse commandline options ////////////////////////////////////////////
     int opt;
     static struct option long_options[] = {
         {"tasks", 0, 0, 't'},
         {"view",  1, 0, 'v'},
+        {"fast", 0, 0, 'f'},
+        {"targets", 0, 0, 'x'},
+        {"tile",  1, 0, 'T'},
+        {"tune",  0, 0, 'u'},
+        {"cull",  0, 0, 'c'},
+        {"compact", 0, 0, 'k'},
+        {"smooth", 0, 0, 's'},
+        {"aa", 1, 0, 'a'},
+        {"iters", 1, 0, 'i'},
         {"help",  0, 0, '?'},
         {0 ,0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "tv:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "tv:fxT:ucksa:i:?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 't':
             useTasks = true;
             break;
+        case 'f':
+            useFast = true;
+            break;
+        case 'x':
+            allTargets = true;
+            break;
+        case 'T':
+            if (sscanf(optarg, "%dx%d", &tileWidth, &tileHeight) != 2 ||
+                tileWidth < 1 || tileHeight < 1) {
+                fprintf(stderr, "Invalid tile size\n");
+                return 1;
+            }
+            useTasks = true;
+            break;
+        case 'u':
+            tuneTiles = true;
+            useTasks = true;
+            break;
+        case 'c':
+            cullInterior = true;
+            break;
+        case 'k':
+            useCompact = true;
+            break;
+        case 's':
+            useSmooth = true;
+            break;
+        case 'a':
+            aaSamples = atoi(optarg);
+            if (aaSamples < 1) {
+                fprintf(stderr, "Invalid number of samples\n");
+                return 1;
+            }
+            break;
+        case 'i':
+            maxIterations = atoi(optarg);
+            if (maxIterations < 1) {
+                fprintf(stderr, "Invalid iteration count\n");
+                return 1;
+            }
+            break;
         case 'v':
         {
             int viewIndex = atoi(optarg);
@@ -152,12 +373,13 @@ int main(int argc, char** argv) {
     double minISPC = 1e30;
     for (int i = 0; i < 3; ++i) {
         double startTime = CycleTimer::currentSeconds();
-        mandelbrot_ispc(x0, y0, x1, y1, width, height, maxIterations, output_ispc);
+        mandelbrot_ispc(x0, y0, x1, y1, width, height, maxIterations, cullInterior, output_ispc);
         double endTime = CycleTimer::currentSeconds();
         minISPC = std::min(minISPC, endTime - startTime);
     }
 
-    printf("[mandelbrot ispc]:\t\t[%.3f] ms\n", minISPC * 1000);
+    printf("[mandelbrot ispc]:\t\t[%.3f] ms\t(%s)\n", minISPC * 1000,
+           ispcTargetName(mandelbrot_ispc_isa()));
     writePPMImage(output_ispc, width, height, "mandelbrot-ispc.ppm", maxIterations);
 
 
@@ -171,6 +393,46 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    //
+    // The same kernel compiled for each target the CPU can run
+    //
+    if (allTargets) {
+        if (!ispcCheckTargets(mandelbrot_ispc_isa_targets)) {
+            delete[] output_serial;
+            delete[] output_ispc;
+            delete[] output_ispc_tasks;
+
+            return 1;
+        }
+
+        for (int isa = 0; isa < NUM_ISPC_ISAS; ++isa) {
+            if (!ispcIsaSupported(isa)) {
+                printf("[mandelbrot ispc %s]:\tnot supported by this CPU\n", ispcTargetName(isa));
+                continue;
+            }
+
+            for (unsigned int i = 0; i < width * height; ++i)
+                output_ispc_tasks[i] = 0;
+
+            double minTarget = 1e30;
+            for (int i = 0; i < 3; ++i) {
+                double startTime = CycleTimer::currentSeconds();
+                mandelbrot_ispc_targets[isa](x0, y0, x1, y1, width, height, maxIterations,
+                                             cullInterior, output_ispc_tasks);
+                double endTime = CycleTimer::currentSeconds();
+                minTarget = std::min(minTarget, endTime - startTime);
+            }
+
+            if (! verifyResult (output_serial, output_ispc_tasks, width, height)) {
+                printf ("Error : %s ISPC output differs from sequential output\n", ispcTargetName(isa));
+                return 1;
+            }
+
+            printf("[mandelbrot ispc %s]:\t[%.3f] ms\t(%.2fx speedup from ISPC)\n",
+                   ispcTargetName(isa), minTarget * 1000, minSerial/minTarget);
+        }
+    }
+
     // Clear out the buffer
     for (unsigned int i = 0; i < width * height; ++i) {
         output_ispc_tasks[i] = 0;
@@ -183,7 +445,7 @@ int main(int argc, char** argv) {
         //
         for (int i = 0; i < 3; ++i) {
             double startTime = CycleTimer::currentSeconds();
-            mandelbrot_ispc_withtasks(x0, y0, x1, y1, width, height, maxIterations, output_ispc_tasks);
+            mandelbrot_ispc_withtasks(x0, y0, x1, y1, width, height, maxIterations, cullInterior, output_ispc_tasks);
             double endTime = CycleTimer::currentSeconds();
             minTaskISPC = std::min(minTaskISPC, endTime - startTime);
         }
@@ -202,6 +464,241 @@ int main(int argc, char** argv) {
         printf("\t\t\t\t(%.2fx speedup from task ISPC)\n", minSerial/minTaskISPC);
     }
 
+    //
+    // FMA and fast math: faster, but the counts are only checked to
+    // within a tolerance
+    //
+    if (useFast) {
+        // Fractions of pixels allowed to differ from the serial output
+        // by one iteration, and by more.  With FMA contraction (built
+        // with g++ -mfma -ffast-math, standing in for ispc), views 1 and
+        // 2 measured 0.09% and 1.4% off by one, 0.21% and 2.1% by more,
+        // and up to 2.4% by more at 2000 iterations.
+        const double maxOffByOne = .05;
+        const double maxOffByMore = .03;
+
+        for (unsigned int i = 0; i < width * height; ++i)
+            output_ispc_tasks[i] = 0;
+
+        double minFastISPC = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            if (useTasks)
+                mandelbrot_ispc_withtasks_fast(x0, y0, x1, y1, width, height, maxIterations,
+                                               cullInterior, output_ispc_tasks);
+            else
+                mandelbrot_ispc_fast(x0, y0, x1, y1, width, height, maxIterations,
+                                     cullInterior, output_ispc_tasks);
+            double endTime = CycleTimer::currentSeconds();
+            minFastISPC = std::min(minFastISPC, endTime - startTime);
+        }
+
+        printf("[mandelbrot fast %sispc]:\t[%.3f] ms\n", useTasks ? "task " : "", minFastISPC * 1000);
+        writePPMImage(output_ispc_tasks, width, height, "mandelbrot-fast-ispc.ppm", maxIterations);
+
+        if (! verifyResultTolerant (output_serial, output_ispc_tasks, width, height,
+                                    maxOffByOne, maxOffByMore)) {
+            printf ("Error : fast ISPC output differs from sequential output in more than %.0f%% of pixels "
+                    "by one iteration, or %.0f%% by more\n", 100. * maxOffByOne, 100. * maxOffByMore);
+            return 1;
+        }
+
+        printf("\t\t\t\t(%.2fx speedup from fast ISPC over exact)\n",
+               (useTasks ? minTaskISPC : minISPC)/minFastISPC);
+    }
+
+    //
+    // Tasks over 2D tiles, of the given shape or the fastest one found
+    //
+    if (tuneTiles)
+        tuneTileShape(x0, y0, x1, y1, width, height, maxIterations, cullInterior,
+                      output_ispc_tasks, tileWidth, tileHeight);
+
+    if (tileWidth > 0) {
+        for (unsigned int i = 0; i < width * height; ++i)
+            output_ispc_tasks[i] = 0;
+
+        double minTileISPC = timeTilesISPC(x0, y0, x1, y1, width, height, tileWidth, tileHeight,
+                                           maxIterations, cullInterior, output_ispc_tasks, 3);
+
+        if (! verifyResult (output_serial, output_ispc_tasks, width, height)) {
+            printf ("Error : tiled ISPC output differs from sequential output\n");
+            return 1;
+        }
+
+        printf("[mandelbrot %dx%d tile ispc]:\t[%.3f] ms\n", tileWidth, tileHeight, minTileISPC * 1000);
+        printf("\t\t\t\t(%.2fx speedup from tiled task ISPC, %.2fx over default tasks)\n",
+               minSerial/minTileISPC, minTaskISPC/minTileISPC);
+    }
+
+    //
+    // Lane-compacting kernel: finished lanes take new pixels instead of
+    // waiting for the rest of the gang.
+    //
+    if (useCompact) {
+        for (unsigned int i = 0; i < width * height; ++i)
+            output_ispc_tasks[i] = 0;
+
+        int64_t laneStats[2];
+        double minCompactISPC = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrot_compact_ispc(x0, y0, x1, y1, width, height, maxIterations,
+                                    output_ispc_tasks, laneStats);
+            double endTime = CycleTimer::currentSeconds();
+            minCompactISPC = std::min(minCompactISPC, endTime - startTime);
+        }
+
+        if (! verifyResult (output_serial, output_ispc_tasks, width, height)) {
+            printf ("Error : compacting ISPC output differs from sequential output\n");
+            return 1;
+        }
+
+        int gangWidth = mandelbrot_ispc_gang_width();
+        printf("[mandelbrot compact ispc]:\t[%.3f] ms\n", minCompactISPC * 1000);
+        printf("\t\t\t\t%.1f%% lane utilization, %.1f%% for foreach (estimated, %d-wide gangs)\n",
+               100. * laneStats[0] / laneStats[1],
+               100. * foreachUtilization(output_serial, width, height, gangWidth), gangWidth);
+        printf("\t\t\t\t(%.2fx speedup from compacting ISPC, %.2fx over %s ISPC)\n",
+               minSerial/minCompactISPC,
+               (useTasks ? minTaskISPC : minISPC)/minCompactISPC, useTasks ? "task" : "plain");
+    }
+
+    //
+    // Run the variant writing the narrowest count type that holds
+    // maxIterations (uint8 only up to 255)
+    //
+    if (maxIterations <= 65535) {
+        bool useUint8 = maxIterations <= 255;
+        const char *formatName = useUint8 ? "uint8" : "uint16";
+        double minCompact;
+        if (useUint8)
+            minCompact = runCompactISPC<uint8_t>(useTasks ? mandelbrot_ispc_withtasks_u8 : mandelbrot_ispc_u8,
+                                                 x0, y0, x1, y1, width, height, maxIterations,
+                                                 cullInterior, output_serial);
+        else
+            minCompact = runCompactISPC<uint16_t>(useTasks ? mandelbrot_ispc_withtasks_u16 : mandelbrot_ispc_u16,
+                                                  x0, y0, x1, y1, width, height, maxIterations,
+                                                  cullInterior, output_serial);
+
+        if (minCompact < 0) {
+            printf ("Error : %s ISPC output differs from sequential output\n", formatName);
+            return 1;
+        }
+
+        double minInt = useTasks ? minTaskISPC : minISPC;
+        printf("[mandelbrot %sispc %s]:\t[%.3f] ms\n", useTasks ? "task " : "", formatName,
+               minCompact * 1000);
+        printf("\t\t\t\t(%.2fx speedup from %s output)\n", minInt/minCompact, formatName);
+    }
+
+    //
+    // Smooth coloring: the ispc kernel computes its logs with a
+    // polynomial, check it against libm
+    //
+    if (useSmooth) {
+        float *smooth_serial = new float[width*height];
+        float *smooth_ispc = new float[width*height];
+
+        double minSmoothSerial = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrotSmoothSerial(x0, y0, x1, y1, width, height, maxIterations, smooth_serial);
+            double endTime = CycleTimer::currentSeconds();
+            minSmoothSerial = std::min(minSmoothSerial, endTime - startTime);
+        }
+
+        double minSmooth = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrot_smooth_ispc(x0, y0, x1, y1, width, height, maxIterations, smooth_ispc);
+            double endTime = CycleTimer::currentSeconds();
+            minSmooth = std::min(minSmooth, endTime - startTime);
+        }
+
+        printf("[mandelbrot smooth serial]:\t[%.3f] ms\n", minSmoothSerial * 1000);
+        printf("[mandelbrot smooth ispc]:\t[%.3f] ms\n", minSmooth * 1000);
+        writeSmoothPPMImage(smooth_ispc, width, height, "mandelbrot-smooth-ispc.ppm");
+
+        double maxError = 0;
+        for (unsigned int i = 0; i < width * height; ++i)
+            maxError = std::max(maxError, (double)fabsf(smooth_ispc[i] - smooth_serial[i]));
+        printf("\t\t\t\tmax error %.2e iterations against libm log2\n",
+               maxError * maxIterations);
+        printf("\t\t\t\t(%.2fx speedup from smooth ISPC)\n", minSmoothSerial/minSmooth);
+
+        delete[] smooth_serial;
+        delete[] smooth_ispc;
+
+        if (maxError * maxIterations > 1e-3) {
+            printf ("Error : Smooth ISPC output differs from the reference\n");
+            return 1;
+        }
+    }
+
+    //
+    // Adaptive anti-aliasing: only pixels on edges of the one sample per
+    // pixel image get aaSamples x aaSamples samples.  Compare it with
+    // supersampling every pixel.
+    //
+    if (aaSamples > 0) {
+        // variance of the 3x3 neighborhood's counts above which a pixel
+        // is refined
+        const float varianceThreshold = 1.f;
+
+        int *aa_base = new int[width*height];
+        float *aa_adaptive = new float[width*height];
+        float *aa_full = new float[width*height];
+        int *refinedPerRow = new int[height];
+
+        double minAdaptive = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrot_aa_ispc(x0, y0, x1, y1, width, height, maxIterations, aaSamples,
+                               varianceThreshold, aa_base, aa_adaptive, refinedPerRow);
+            double endTime = CycleTimer::currentSeconds();
+            minAdaptive = std::min(minAdaptive, endTime - startTime);
+        }
+
+        long long numRefined = 0;
+        for (unsigned int j = 0; j < height; ++j)
+            numRefined += refinedPerRow[j];
+
+        if (! verifyResult (output_serial, aa_base, width, height)) {
+            printf ("Error : ISPC anti-aliasing base pass differs from sequential output\n");
+            return 1;
+        }
+
+        // a negative threshold refines every pixel
+        double minFull = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            mandelbrot_aa_ispc(x0, y0, x1, y1, width, height, maxIterations, aaSamples,
+                               -1.f, aa_base, aa_full, refinedPerRow);
+            double endTime = CycleTimer::currentSeconds();
+            minFull = std::min(minFull, endTime - startTime);
+        }
+
+        int numOff = 0;
+        for (unsigned int i = 0; i < width * height; ++i)
+            numOff += fabsf(aa_adaptive[i] - aa_full[i]) > .5f;
+
+        double numSamples = (double)width * height + (double)numRefined * (aaSamples * aaSamples - 1);
+        printf("[mandelbrot %dx%d full aa ispc]:\t[%.3f] ms\n", aaSamples, aaSamples, minFull * 1000);
+        printf("[mandelbrot adaptive aa ispc]:\t[%.3f] ms\n", minAdaptive * 1000);
+        printf("\t\t\t\t%.2f%% of pixels refined, %.2f samples per pixel\n",
+               100. * numRefined / (width * height), numSamples / (width * height));
+        printf("\t\t\t\t%.2f%% of pixels off by more than half an iteration from full aa\n",
+               100. * numOff / (width * height));
+        printf("\t\t\t\t(%.2fx speedup from adaptive aa)\n", minFull/minAdaptive);
+        writeFloatPPMImage(aa_adaptive, width, height, "mandelbrot-aa-ispc.ppm", maxIterations);
+
+        delete[] aa_base;
+        delete[] aa_adaptive;
+        delete[] aa_full;
+        delete[] refinedPerRow;
+    }
+
     delete[] output_serial;
     delete[] output_ispc;
     delete[] output_ispc_tasks;
@@ -37,6 +37,8 @@
    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <math.h>
+
 
 static inline int mandel(float c_re, float c_im, int count)
 {
@@ -90,3 +92,48 @@ void mandelbrotSerial(
     }
 }
 
+
+//
+// MandelbrotSmoothSerial --
+//
+// Smooth escape time of every pixel, n + 2 - log2(log2(|z_n|^2)) with
+// z_n the first orbit value past the bailout, divided by maxIterations
+// and clamped below 1.  Points that never escape get 1.  Uses libm, as
+// the reference for the polynomial log2 of mandelbrot_smooth_ispc().
+void mandelbrotSmoothSerial(
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations,
+    float output[])
+{
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; ++i) {
+            float c_re = x0 + i * dx;
+            float c_im = y0 + j * dy;
+
+            float z_re = c_re, z_im = c_im;
+            float mag = 0.f;
+            int k;
+            for (k = 0; k < maxIterations; ++k) {
+                mag = z_re * z_re + z_im * z_im;
+                if (mag > 4.f)
+                    break;
+
+                float new_re = z_re*z_re - z_im*z_im;
+                float new_im = 2.f * z_re * z_im;
+                z_re = c_re + new_re;
+                z_im = c_im + new_im;
+            }
+
+            float value = 1.f;
+            if (k < maxIterations) {
+                double nu = k + 2. - log2(log2((double)mag));
+                value = fminf(fmaxf((float)(nu / maxIterations), 0.f), 0.99999994f);
+            }
+            output[j * width + i] = value;
+        }
+    }
+}
@@ -4,6 +4,7 @@
 #include <math.h>
 
 #include "CycleTimer.h"
+#include "ispcTargets.h"
 #include "sqrt_ispc.h"
 
 using namespace ispc;
@@ -12,6 +13,11 @@ extern void sqrtSerial(int N, float startGuess, float* values, float* output);
 extern void sqrtAVX2(int N, float initialGuess, float* values, float* output);
 extern void sqrtAVXNative(int N, float initialGuess, float values[], float output[]);
 
+typedef void SqrtISPCFunc(int N, float initialGuess, float values[], float output[]);
+
+ISPC_DECLARE_TARGETS(SqrtISPCFunc, sqrt_ispc);
+ISPC_DECLARE_TARGETS(IspcIsaFunc, sqrt_ispc_isa);
+
 static void verifyResult(int N, float* result, float* gold) {
     for (int i=0; i<N; i++) {
         if (fabs(result[i] - gold[i]) > 1e-4) {
@@ -80,10 +86,37 @@ int main() {
         minISPC = std::min(minISPC, endTime - startTime);
     }
 
-    printf("[sqrt ispc]:\t\t[%.3f] ms\n", minISPC * 1000);
+    printf("[sqrt ispc]:\t\t[%.3f] ms\t(%s)\n", minISPC * 1000,
+           ispcTargetName(sqrt_ispc_isa()));
 
     verifyResult(N, output, gold);
 
+    //
+    // The same kernel compiled for each target the CPU can run
+    //
+    if (!ispcCheckTargets(sqrt_ispc_isa_targets))
+        return 1;
+
+    for (int isa = 0; isa < NUM_ISPC_ISAS; ++isa) {
+        if (!ispcIsaSupported(isa)) {
+            printf("[sqrt ispc %s]:\tnot supported by this CPU\n", ispcTargetName(isa));
+            continue;
+        }
+
+        double minTarget = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            sqrt_ispc_targets[isa](N, initialGuess, values, output);
+            double endTime = CycleTimer::currentSeconds();
+            minTarget = std::min(minTarget, endTime - startTime);
+        }
+
+        printf("[sqrt ispc %s]:\t[%.3f] ms\t(%.2fx speedup from ISPC)\n",
+               ispcTargetName(isa), minTarget * 1000, minSerial/minTarget);
+
+        verifyResult(N, output, gold);
+    }
+
     // Clear out the buffer
     for (unsigned int i = 0; i < N; ++i)
         output[i] = 0;
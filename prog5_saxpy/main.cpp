@@ -2,6 +2,7 @@
 #include <algorithm>
 
 #include "CycleTimer.h"
+#include "ispcTargets.h"
 #include "saxpy_ispc.h"
 
 extern void saxpySerial(int N, float a, float* X, float* Y, float* result);
@@ -18,6 +19,11 @@ toGFLOPS(int ops, float sec) {
     return static_cast<float>(ops) / 1e9 / sec;
 }
 
+typedef void SaxpyISPCFunc(int N, float scale, float X[], float Y[], float result[]);
+
+ISPC_DECLARE_TARGETS(SaxpyISPCFunc, saxpy_ispc);
+ISPC_DECLARE_TARGETS(IspcIsaFunc, saxpy_ispc_isa);
+
 static void verifyResult(int N, float* result, float* gold) {
     for (int i=0; i<N; i++) {
         if (result[i] != gold[i]) {
@@ -83,10 +89,40 @@ int main() {
 
     verifyResult(N, resultISPC, resultSerial);
 
-    printf("[saxpy ispc]:\t\t[%.3f] ms\t[%.3f] GB/s\t[%.3f] GFLOPS\n",
+    printf("[saxpy ispc]:\t\t[%.3f] ms\t[%.3f] GB/s\t[%.3f] GFLOPS\t(%s)\n",
            minISPC * 1000,
            toBW(TOTAL_BYTES, minISPC),
-           toGFLOPS(TOTAL_FLOPS, minISPC));
+           toGFLOPS(TOTAL_FLOPS, minISPC),
+           ispcTargetName(saxpy_ispc_isa()));
+
+    //
+    // The same kernel compiled for each target the CPU can run
+    //
+    if (!ispcCheckTargets(saxpy_ispc_isa_targets))
+        return 1;
+
+    for (int isa = 0; isa < NUM_ISPC_ISAS; ++isa) {
+        if (!ispcIsaSupported(isa)) {
+            printf("[saxpy ispc %s]:\tnot supported by this CPU\n", ispcTargetName(isa));
+            continue;
+        }
+
+        double minTarget = 1e30;
+        for (int i = 0; i < 3; ++i) {
+            double startTime = CycleTimer::currentSeconds();
+            saxpy_ispc_targets[isa](N, scale, arrayX, arrayY, resultISPC);
+            double endTime = CycleTimer::currentSeconds();
+            minTarget = std::min(minTarget, endTime - startTime);
+        }
+
+        verifyResult(N, resultISPC, resultSerial);
+
+        printf("[saxpy ispc %s]:\t[%.3f] ms\t[%.3f] GB/s\t[%.3f] GFLOPS\n",
+               ispcTargetName(isa),
+               minTarget * 1000,
+               toBW(TOTAL_BYTES, minTarget),
+               toGFLOPS(TOTAL_FLOPS, minTarget));
+    }
 
     //
     // Run the ISPC (multi-core) implementation